@@ -49,6 +49,14 @@
  *        was found. ENTRYLO is not actually used, but must be set; 0
  *        should be passed.
  *
+ *   tlb_setpid: load ENTRYHI into the entryhi register without doing
+ *        anything else. Only its PID field matters: this selects the
+ *        address space ID that user translations are matched against.
+ *
+ *        All of the above functions leave the entryhi register set to
+ *        the value passed in, so the PID field must be restored (or
+ *        passed in to begin with) before returning to user mode.
+ *
  *        IMPORTANT NOTE: An entry may be matching even if the valid bit
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
@@ -59,14 +67,16 @@ void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setpid(uint32_t entryhi);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID), which
+ * is compared with the PID field of the entryhi register on every
+ * lookup. Entries with TLBLO_GLOBAL set match regardless of PID; we
+ * use those only for kernel mappings in kseg2. The bits that aren't
+ * assigned a meaning can be left always zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,14 +88,15 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
 #define TLBLO_NOCACHE 0x00000800
 #define TLBLO_DIRTY   0x00000400
 #define TLBLO_VALID   0x00000200
-/*      TLBLO_GLOBAL  0x00000100 */
+#define TLBLO_GLOBAL  0x00000100
 
 /*
  * Values for completely invalid TLB entries. The TLB entry index should
@@ -101,5 +112,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of distinct address space IDs.
+ */
+
+#define NUM_TLBPID  64
+
 
 #endif /* _MIPS_TLB_H_ */
@@ -67,6 +67,15 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/*
+ * And back again. KVADDR_ISDIRECT tells whether a kernel virtual
+ * address is one of these; kernel memory mapped through the TLB
+ * (kseg2) has no fixed physical address and need not be physically
+ * contiguous.
+ */
+#define KVADDR_ISDIRECT(vaddr) ((vaddr) >= MIPS_KSEG0 && (vaddr) < MIPS_KSEG1)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -83,6 +92,22 @@
  */
 #define USERSTACK     USERSPACETOP
 
+/*
+ * Page table entry layout.
+ *
+ * A page table entry is laid out the same as the TLB's EntryLo
+ * word, so that a resident translation can be loaded into the TLB
+ * without being rearranged: the physical page number lives in the
+ * high 20 bits, PTE_WRITE is the TLB "dirty" (write enable) bit,
+ * and PTE_VALID is the TLB valid bit. The low byte of the word is
+ * ignored by the hardware and is available for software flags,
+ * which are defined in <pagetable.h>.
+ */
+#define PTE_FRAME     0xfffff000  /* physical page number */
+#define PTE_WRITE     0x00000400  /* hardware write enable (TLBLO_DIRTY) */
+#define PTE_VALID     0x00000200  /* page is resident (TLBLO_VALID) */
+#define PTE_TLBMASK   (PTE_FRAME | PTE_WRITE | PTE_VALID)
+
 /*
  * Interface to the low-level module that looks after the amount of
  * physical memory we have.
@@ -113,14 +138,33 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
+ * Invalidations are collected in a struct tlbbatch (see vm_tlbbatch_*
+ * in <vm.h>), each entry a range of pages in one address space, and
+ * sent together to just the CPUs that may have any of them cached.
+ * A shootdown request carries a pointer to the batch; each target
+ * decrements tb_pending when it's done, and the sender waits once
+ * for the count to reach zero.
+ *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+#define TLBBATCH_MAX 16
+
+struct tlbrange {
+	uint32_t tr_pid;		/* address space (TLBHI_PID) */
+	vaddr_t tr_start;		/* first page */
+	unsigned tr_npages;		/* number of pages */
+};
+
+struct tlbbatch {
+	struct tlbrange tb_ranges[TLBBATCH_MAX];
+	unsigned tb_nranges;
+	uint32_t tb_cpus;		/* CPUs that may cache any of them */
+	volatile unsigned tb_pending;	/* targets not yet done */
+};
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct tlbbatch *ts_batch;
 };
 
 #define TLBSHOOTDOWN_MAX 16
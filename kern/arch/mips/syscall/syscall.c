@@ -109,6 +109,15 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS___diskstat:
+		err = sys___diskstat(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 
 	    default:
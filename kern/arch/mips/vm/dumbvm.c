@@ -298,7 +298,8 @@ as_deactivate(void)
 
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
-		 int readable, int writeable, int executable)
+		 int readable, int writeable, int executable,
+		 struct vnode *v, off_t offset, size_t filesize)
 {
 	size_t npages;
 
@@ -318,6 +319,11 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	(void)writeable;
 	(void)executable;
 
+	/* Nor these - load_elf reads the whole file in up front */
+	(void)v;
+	(void)offset;
+	(void)filesize;
+
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
@@ -0,0 +1,947 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <proc.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <platform/maxcpus.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/*
+ * MIPS VM system: fault handling and TLB management on top of the
+ * coremap (kern/vm/coremap.c) and per-address-space page tables
+ * (kern/vm/pagetable.c).
+ *
+ * The MIPS TLB is software-refilled. A miss on a resident page is
+ * handled by the refill code in exception-mips1.S, which walks the
+ * page table itself. Everything else comes here via vm_fault, which
+ * looks the page up in the current address space's page table,
+ * allocating a page on first touch, and loads the translation into
+ * the TLB. New pages are read in from the region's backing file
+ * (program text and data) or zero-filled (bss, stack).
+ *
+ * After fork, parent and child share their pages copy-on-write: the
+ * pages are mapped read-only in both, and the first write through
+ * either mapping takes a fault that gives the writer its own copy
+ * (or just restores write access if nobody else still shares it).
+ *
+ * When memory runs out the coremap pushes pages out to swap; their
+ * page table entries then hold a swap slot, and the next fault on
+ * them reads them back in. Resident pages are pinned (see
+ * <coremap.h>) while we look at them so they can't be paged out from
+ * under us.
+ *
+ * The kernel also maps some of its own memory through the TLB, in
+ * kseg2; see alloc_kvpages below.
+ */
+
+/*
+ * Address space IDs.
+ *
+ * Each address space is given one of the hardware's NUM_TLBPID
+ * address space IDs when it is activated, and TLB entries are tagged
+ * with it, so switching address spaces doesn't require flushing the
+ * TLB. IDs are handed out in order; when they run out, a new
+ * generation starts and IDs are reused. as_asid holds the generation
+ * in its upper bits, so an address space whose ID is from an old
+ * generation gets a new one the next time it's activated.
+ *
+ * Each CPU remembers which generation its TLB contents belong to and
+ * flushes its TLB the first time it activates an address space from
+ * a newer one. Until it does, the only old IDs it can be using are
+ * that of whatever it was already running, so no CPU ever matches an
+ * entry left over from a previous owner of its current ID.
+ *
+ * as_cpumask records which CPUs have run the address space with its
+ * current ID and so may have its translations cached; shootdowns go
+ * only to those.
+ */
+#define ASID_GEN(asid)	((asid) / NUM_TLBPID)
+#define ASID_PID(asid)	((asid) % NUM_TLBPID)
+
+static struct spinlock vm_asidlock = SPINLOCK_INITIALIZER;
+static uint32_t vm_asidgen = 1;		/* current generation */
+static uint32_t vm_nextpid;		/* next PID to hand out */
+
+/* Per-CPU MMU state, indexed by CPU number. */
+static struct {
+	uint32_t vc_asidgen;		/* generation of our TLB contents */
+	uint32_t vc_pid;		/* PID we're running with */
+} vm_cpus[MAXCPUS];
+
+/*
+ * Page directory of the address space active on each CPU, or NULL,
+ * for the TLB refill code in exception-mips1.S. Protected by
+ * vm_asidlock.
+ */
+vaddr_t cpuptdirs[MAXCPUS];
+
+/*
+ * Shootdown batches are sent one at a time, so no CPU ever has more
+ * than one queued. Senders wait on vm_shootdown_wchan for their
+ * batch's tb_pending to drop to zero.
+ */
+static struct lock *vm_shootdown_lock;
+static struct spinlock vm_shootdown_spinlock = SPINLOCK_INITIALIZER;
+static struct wchan *vm_shootdown_wchan;
+
+/* Ranges longer than this are invalidated by scanning the whole TLB. */
+#define TLBRANGE_PROBEMAX  (NUM_TLB / 4)
+
+/*
+ * Kernel virtual pages.
+ *
+ * Multi-page kernel allocations can be made from single frames
+ * mapped at consecutive addresses in kseg2, so they don't need
+ * physically contiguous memory. kvpt[] holds a PTE for each page of
+ * the KVPAGES_MAX pages at the bottom of kseg2; vm_fault loads them
+ * into the TLB on demand with TLBLO_GLOBAL set, so they're valid in
+ * every address space. The table is only changed for pages nobody
+ * can be using, so vm_fault reads it without locking.
+ *
+ * Each allocation is followed by a guard page that is never mapped,
+ * to catch running off the end. kvnpages[] holds the length of each
+ * allocation, guard page included, at the index of its first page.
+ *
+ * Freed pages may still be cached in other CPUs' TLBs, so they can't
+ * be handed out again straight away. Instead of a shootdown per free
+ * they're marked stale, and once there's no clean space left all the
+ * stale pages are recycled together after one shootdown of kseg2.
+ * (This also means free_kpages never has to wait for other CPUs.)
+ * The frames themselves are released immediately; only a dangling
+ * pointer could still reach them through a stale entry.
+ */
+#define KVPAGES_MAX	4096		/* 16M of kseg2 */
+#define KVPTE_RESERVED	0x1		/* allocated but not mapped */
+#define KVPTE_STALE	0x2		/* freed; may be in other TLBs */
+#define KVPTE_FLUSHING	0x4		/* stale, being shot down */
+
+static pte_t kvpt[KVPAGES_MAX];
+static uint16_t kvnpages[KVPAGES_MAX];
+static struct spinlock kvlock = SPINLOCK_INITIALIZER;
+static unsigned kvhint;			/* where to start looking */
+static unsigned kvnstale;		/* pages marked stale */
+static struct lock *kvrecyclelock;	/* one recycler at a time */
+
+#define KVADDR(index)	(MIPS_KSEG2 + (index) * PAGE_SIZE)
+#define KVINDEX(addr)	(((addr) - MIPS_KSEG2) / PAGE_SIZE)
+
+static void vm_tlbdrop(uint32_t pid, vaddr_t start, unsigned npages);
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+
+	vm_shootdown_lock = lock_create("vm_shootdown");
+	if (vm_shootdown_lock == NULL) {
+		panic("vm: cannot create shootdown lock\n");
+	}
+	vm_shootdown_wchan = wchan_create("vm_shootdown");
+	if (vm_shootdown_wchan == NULL) {
+		panic("vm: cannot create shootdown wait channel\n");
+	}
+	kvrecyclelock = lock_create("kvrecycle");
+	if (kvrecyclelock == NULL) {
+		panic("vm: cannot create kernel virtual page lock\n");
+	}
+
+	swap_bootstrap();
+	coremap_startpageout();
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	pa = coremap_alloc_kpages(npages);
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	if (addr >= MIPS_KSEG2) {
+		free_kvpages(addr);
+		return;
+	}
+	KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+	coremap_free(addr - MIPS_KSEG0);
+}
+
+/*
+ * Find NPAGES consecutive free entries in kvpt, or return
+ * KVPAGES_MAX. Call with kvlock held.
+ */
+static
+unsigned
+kvpages_findrun(unsigned npages)
+{
+	unsigned i, start, run, scanned;
+
+	start = kvhint;
+	run = 0;
+	for (scanned = 0; scanned < KVPAGES_MAX + npages; scanned++) {
+		i = (kvhint + scanned) % KVPAGES_MAX;
+		if (i == 0) {
+			/* Runs don't wrap around. */
+			run = 0;
+		}
+		if (kvpt[i] != 0) {
+			run = 0;
+			continue;
+		}
+		if (run == 0) {
+			start = i;
+		}
+		if (++run == npages) {
+			return start;
+		}
+	}
+	return KVPAGES_MAX;
+}
+
+/*
+ * Shoot down all the stale pages and make them available again.
+ */
+static
+void
+kvpages_recycle(void)
+{
+	struct tlbbatch tb;
+	unsigned i;
+
+	lock_acquire(kvrecyclelock);
+
+	/* Pages that go stale during the shootdown have to wait. */
+	spinlock_acquire(&kvlock);
+	for (i=0; i<KVPAGES_MAX; i++) {
+		if (kvpt[i] == KVPTE_STALE) {
+			kvpt[i] = KVPTE_FLUSHING;
+		}
+	}
+	spinlock_release(&kvlock);
+
+	vm_tlbbatch_init(&tb);
+	vm_tlbbatch_add(&tb, NULL, MIPS_KSEG2, KVPAGES_MAX);
+	vm_tlbbatch_flush(&tb);
+
+	spinlock_acquire(&kvlock);
+	for (i=0; i<KVPAGES_MAX; i++) {
+		if (kvpt[i] == KVPTE_FLUSHING) {
+			kvpt[i] = 0;
+			KASSERT(kvnstale > 0);
+			kvnstale--;
+		}
+	}
+	spinlock_release(&kvlock);
+
+	lock_release(kvrecyclelock);
+}
+
+/*
+ * Allocate NPAGES pages of kernel memory, mapped at consecutive
+ * addresses in kseg2 but not necessarily physically contiguous.
+ * Returns 0 if there's no memory or no space in kseg2, or if it's
+ * too early in boot to do this.
+ *
+ * Making stale pages usable again means waiting for a shootdown, so
+ * callers that can't sleep (in an interrupt handler, or holding a
+ * spinlock) don't do it; if there's no room without it, they get 0
+ * and kmalloc uses contiguous pages as it always has. The next
+ * caller that can sleep does the recycling.
+ */
+vaddr_t
+alloc_kvpages(unsigned npages)
+{
+	unsigned index, i, need;
+	bool cansleep;
+	paddr_t pa;
+
+	KASSERT(npages > 0);
+	if (kvrecyclelock == NULL || npages >= KVPAGES_MAX) {
+		return 0;
+	}
+	need = npages + 1;
+	cansleep = !curthread->t_in_interrupt && curcpu->c_spinlocks == 0;
+
+	spinlock_acquire(&kvlock);
+	index = kvpages_findrun(need);
+	if (index == KVPAGES_MAX && kvnstale > 0 && cansleep) {
+		spinlock_release(&kvlock);
+		kvpages_recycle();
+		spinlock_acquire(&kvlock);
+		index = kvpages_findrun(need);
+	}
+	if (index == KVPAGES_MAX) {
+		spinlock_release(&kvlock);
+		return 0;
+	}
+	for (i=0; i<need; i++) {
+		kvpt[index + i] = KVPTE_RESERVED;
+	}
+	kvnpages[index] = need;
+	kvhint = (index + need) % KVPAGES_MAX;
+	spinlock_release(&kvlock);
+
+	/*
+	 * Get the frames without holding the spinlock. This only
+	 * sleeps (to evict something) if the caller can.
+	 */
+	for (i=0; i<npages; i++) {
+		pa = coremap_alloc_kpages(1);
+		if (pa == 0) {
+			break;
+		}
+		kvpt[index + i] = pa | PTE_WRITE | PTE_VALID;
+	}
+
+	if (i < npages) {
+		/* Out of memory; nothing was ever mapped, so no TLB mess. */
+		spinlock_acquire(&kvlock);
+		while (i-- > 0) {
+			coremap_free(kvpt[index + i] & PTE_FRAME);
+		}
+		for (i=0; i<need; i++) {
+			kvpt[index + i] = 0;
+		}
+		kvnpages[index] = 0;
+		spinlock_release(&kvlock);
+		return 0;
+	}
+
+	return KVADDR(index);
+}
+
+/*
+ * Free pages allocated with alloc_kvpages. Doesn't sleep.
+ */
+void
+free_kvpages(vaddr_t addr)
+{
+	unsigned index, i, need;
+
+	KASSERT((addr & PAGE_FRAME) == addr);
+	KASSERT(addr >= MIPS_KSEG2 && addr < KVADDR(KVPAGES_MAX));
+	index = KVINDEX(addr);
+
+	spinlock_acquire(&kvlock);
+	need = kvnpages[index];
+	KASSERT(need > 1 && index + need <= KVPAGES_MAX);
+	kvnpages[index] = 0;
+	for (i=0; i<need; i++) {
+		if (kvpt[index + i] & PTE_VALID) {
+			coremap_free(kvpt[index + i] & PTE_FRAME);
+		}
+		else {
+			/* the guard page */
+			KASSERT(i == need - 1);
+			KASSERT(kvpt[index + i] == KVPTE_RESERVED);
+		}
+		kvpt[index + i] = KVPTE_STALE;
+	}
+	kvnstale += need;
+	spinlock_release(&kvlock);
+
+	/* Our own TLB we can take care of now. */
+	vm_tlbdrop(0, addr, need);
+}
+
+/*
+ * Restore the current PID in entryhi after frobbing the TLB. The
+ * caller should have interrupts off.
+ */
+static
+void
+vm_restorepid(void)
+{
+	tlb_setpid(vm_cpus[curcpu->c_number].vc_pid << TLBHI_PIDSHIFT);
+}
+
+void
+vm_flushtlb(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	vm_restorepid();
+
+	splx(spl);
+}
+
+void
+vm_activate(struct addrspace *as)
+{
+	unsigned cpunum;
+	uint32_t gen;
+	int spl;
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+
+	spinlock_acquire(&vm_asidlock);
+	if (as == NULL) {
+		cpuptdirs[cpunum] = 0;
+		spinlock_release(&vm_asidlock);
+		splx(spl);
+		return;
+	}
+	if (ASID_GEN(as->as_asid) != vm_asidgen) {
+		if (vm_nextpid == NUM_TLBPID) {
+			vm_asidgen++;
+			vm_nextpid = 0;
+		}
+		as->as_asid = vm_asidgen * NUM_TLBPID + vm_nextpid++;
+		as->as_cpumask = 0;
+	}
+	as->as_cpumask |= (uint32_t)1 << cpunum;
+	gen = vm_asidgen;
+	cpuptdirs[cpunum] = (vaddr_t)as->as_pt->pt_dir;
+	spinlock_release(&vm_asidlock);
+
+	vm_cpus[cpunum].vc_pid = ASID_PID(as->as_asid);
+	if (vm_cpus[cpunum].vc_asidgen != gen) {
+		/* IDs have been reused since our TLB was loaded. */
+		vm_cpus[cpunum].vc_asidgen = gen;
+		vm_flushtlb();
+	}
+	else {
+		vm_restorepid();
+	}
+
+	splx(spl);
+}
+
+void
+vm_destroyas(struct addrspace *as)
+{
+	unsigned i;
+
+	/*
+	 * A CPU that last ran AS and has since only run kernel threads
+	 * still has it set up for TLB refills. Its TLB entries can stay;
+	 * the ID won't be used again until the next generation.
+	 */
+	spinlock_acquire(&vm_asidlock);
+	for (i=0; i<MAXCPUS; i++) {
+		if (cpuptdirs[i] == (vaddr_t)as->as_pt->pt_dir) {
+			cpuptdirs[i] = 0;
+		}
+	}
+	spinlock_release(&vm_asidlock);
+}
+
+/*
+ * Drop any translations for the NPAGES pages starting at START with
+ * PID from this CPU's TLB. Short ranges are probed for page by page;
+ * long ones are dealt with by checking every TLB entry.
+ */
+static
+void
+vm_tlbdrop(uint32_t pid, vaddr_t start, unsigned npages)
+{
+	uint32_t ehi, elo;
+	vaddr_t end;
+	unsigned i;
+	int index, spl;
+
+	end = start + npages * PAGE_SIZE;
+
+	spl = splhigh();
+	if (npages <= TLBRANGE_PROBEMAX) {
+		for (; start < end; start += PAGE_SIZE) {
+			ehi = (start & TLBHI_VPAGE) | (pid << TLBHI_PIDSHIFT);
+			index = tlb_probe(ehi, 0);
+			if (index >= 0) {
+				tlb_write(TLBHI_INVALID(index),
+					  TLBLO_INVALID(), index);
+			}
+		}
+	}
+	else {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) == 0 ||
+			    ((elo & TLBLO_GLOBAL) == 0 &&
+			     (ehi & TLBHI_PID) >> TLBHI_PIDSHIFT != pid) ||
+			    (ehi & TLBHI_VPAGE) < start ||
+			    (ehi & TLBHI_VPAGE) >= end) {
+				continue;
+			}
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	vm_restorepid();
+	splx(spl);
+}
+
+void
+vm_tlbbatch_init(struct tlbbatch *tb)
+{
+	tb->tb_nranges = 0;
+	tb->tb_cpus = 0;
+	tb->tb_pending = 0;
+}
+
+void
+vm_tlbbatch_add(struct tlbbatch *tb, struct addrspace *as,
+		vaddr_t start, unsigned npages)
+{
+	struct tlbrange *tr;
+	uint32_t pid, cpus;
+
+	KASSERT((start & PAGE_FRAME) == start);
+
+	if (as == NULL) {
+		/* Kernel (global) mappings; any CPU may have them. */
+		pid = 0;
+		cpus = num_cpus >= 32 ? 0xffffffff :
+			((uint32_t)1 << num_cpus) - 1;
+	}
+	else {
+		spinlock_acquire(&vm_asidlock);
+		pid = ASID_PID(as->as_asid);
+		cpus = as->as_cpumask;
+		spinlock_release(&vm_asidlock);
+	}
+
+	if (cpus == 0 || npages == 0) {
+		/* Never activated since it got its ID; nothing cached. */
+		return;
+	}
+
+	/* Extend the previous range if this one follows on from it. */
+	if (tb->tb_nranges > 0) {
+		tr = &tb->tb_ranges[tb->tb_nranges - 1];
+		if (tr->tr_pid == pid &&
+		    tr->tr_start + tr->tr_npages * PAGE_SIZE == start) {
+			tr->tr_npages += npages;
+			tb->tb_cpus |= cpus;
+			return;
+		}
+	}
+
+	if (tb->tb_nranges == TLBBATCH_MAX) {
+		vm_tlbbatch_flush(tb);
+	}
+	tr = &tb->tb_ranges[tb->tb_nranges++];
+	tr->tr_pid = pid;
+	tr->tr_start = start;
+	tr->tr_npages = npages;
+	tb->tb_cpus |= cpus;
+}
+
+/*
+ * Invalidate everything in batch TB on this CPU.
+ */
+static
+void
+vm_tlbbatch_drop(const struct tlbbatch *tb)
+{
+	const struct tlbrange *tr;
+	unsigned i;
+
+	for (i=0; i<tb->tb_nranges; i++) {
+		tr = &tb->tb_ranges[i];
+		vm_tlbdrop(tr->tr_pid, tr->tr_start, tr->tr_npages);
+	}
+}
+
+void
+vm_tlbbatch_flush(struct tlbbatch *tb)
+{
+	struct tlbshootdown ts;
+	uint32_t targets;
+	unsigned i;
+	int spl;
+
+	if (tb->tb_nranges == 0) {
+		return;
+	}
+
+	lock_acquire(vm_shootdown_lock);
+
+	/* Don't migrate to another CPU between these. */
+	spl = splhigh();
+	vm_tlbbatch_drop(tb);
+	targets = tb->tb_cpus & ~((uint32_t)1 << curcpu->c_number);
+	tb->tb_pending = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		if (targets & ((uint32_t)1 << i)) {
+			tb->tb_pending++;
+		}
+	}
+	if (targets != 0) {
+		ts.ts_batch = tb;
+		ipi_tlbshootdown_mask(targets, &ts);
+	}
+	splx(spl);
+
+	spinlock_acquire(&vm_shootdown_spinlock);
+	while (tb->tb_pending > 0) {
+		wchan_sleep(vm_shootdown_wchan, &vm_shootdown_spinlock);
+	}
+	spinlock_release(&vm_shootdown_spinlock);
+
+	lock_release(vm_shootdown_lock);
+
+	vm_tlbbatch_init(tb);
+}
+
+void
+vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	struct tlbbatch tb;
+
+	vm_tlbbatch_init(&tb);
+	vm_tlbbatch_add(&tb, as, vaddr & PAGE_FRAME, 1);
+	vm_tlbbatch_flush(&tb);
+}
+
+/*
+ * Load the translation PTE for VADDR in the current address space
+ * (or kseg2) into the TLB, replacing any existing entry for the same
+ * page (there must never be two).
+ */
+static
+void
+vm_tlbload(vaddr_t vaddr, pte_t pte)
+{
+	uint32_t ehi, elo;
+	int index, spl;
+
+	elo = pte & PTE_TLBMASK;
+	if (vaddr >= MIPS_KSEG2) {
+		elo |= TLBLO_GLOBAL;
+	}
+
+	spl = splhigh();
+	ehi = (vaddr & TLBHI_VPAGE) |
+		(vm_cpus[curcpu->c_number].vc_pid << TLBHI_PIDSHIFT);
+	index = tlb_probe(ehi, 0);
+	if (index >= 0) {
+		tlb_write(ehi, elo, index);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	splx(spl);
+}
+
+/*
+ * Allocate and fill in the page at VADDR, which is in region RG of
+ * AS and has never been touched before. Whatever part of the page
+ * lies within the region's file-backed range is read from the file;
+ * the rest is zero-filled.
+ */
+static
+int
+vm_pagein(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	  paddr_t *ret)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end, fileend;
+	paddr_t pa;
+	int result;
+
+	start = end = vaddr;
+	if (rg->rg_vnode != NULL) {
+		fileend = rg->rg_filevaddr + rg->rg_filesize;
+		start = vaddr > rg->rg_filevaddr ? vaddr : rg->rg_filevaddr;
+		end = vaddr + PAGE_SIZE < fileend ? vaddr + PAGE_SIZE : fileend;
+		if (start > end) {
+			start = end = vaddr;
+		}
+	}
+
+	/* Skip zeroing if the file covers the whole page. */
+	pa = coremap_alloc_upage(as, vaddr,
+				 start != vaddr || end != vaddr + PAGE_SIZE);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+
+	if (start < end) {
+		DEBUG(DB_VM, "vm: reading %u bytes at 0x%x from file\n",
+		      end - start, start);
+		uio_kinit(&iov, &ku,
+			  (void *)(PADDR_TO_KVADDR(pa) + (start - vaddr)),
+			  end - start,
+			  rg->rg_fileoffset + (start - rg->rg_filevaddr),
+			  UIO_READ);
+		result = VOP_READ(rg->rg_vnode, &ku);
+		if (result == 0 && ku.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("vm: short read on paged segment - "
+				"file truncated?\n");
+			result = ENOEXEC;
+		}
+		if (result) {
+			coremap_free(pa);
+			return result;
+		}
+	}
+
+	*ret = pa;
+	return 0;
+}
+
+/*
+ * Make the page mapped by PTE at VADDR privately writable by AS.
+ */
+static
+int
+vm_breakcow(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(*pte & PTE_VALID);
+
+	oldpa = *pte & PTE_FRAME;
+	if (coremap_claim(oldpa, as, vaddr)) {
+		/* Nobody else has it any more. */
+		*pte |= PTE_WRITE;
+		return 0;
+	}
+
+	newpa = coremap_alloc_upage(as, vaddr, false);
+	if (newpa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	*pte = newpa | (*pte & ~PTE_FRAME) | PTE_WRITE;
+	coremap_free(oldpa);
+
+	/* Other CPUs may still map the shared page for us. */
+	vm_tlbinvalidate(as, vaddr);
+
+	DEBUG(DB_VM, "vm: copied 0x%x for write at 0x%x\n", oldpa, vaddr);
+	return 0;
+}
+
+/*
+ * Bring the page at VADDR back in from swap slot SLOT. Unless it's
+ * about to be written (WRITING is set), the page keeps the slot, so
+ * it can be evicted again without writing it out; in that case the
+ * caller must map it without PTE_WRITE.
+ */
+static
+int
+vm_swapin(struct addrspace *as, vaddr_t vaddr, unsigned slot, bool writing,
+	  paddr_t *ret)
+{
+	paddr_t pa;
+	int result;
+
+	pa = coremap_alloc_upage(as, vaddr, false);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_pagein(pa, slot);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+	if (writing) {
+		swap_free(slot);
+	}
+	else {
+		coremap_setclean(pa, slot);
+	}
+
+	DEBUG(DB_VM, "vm: 0x%x in from swap slot %u\n", vaddr, slot);
+	*ret = pa;
+	return 0;
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	struct tlbbatch *tb = ts->ts_batch;
+
+	vm_tlbbatch_drop(tb);
+
+	spinlock_acquire(&vm_shootdown_spinlock);
+	KASSERT(tb->tb_pending > 0);
+	tb->tb_pending--;
+	if (tb->tb_pending == 0) {
+		wchan_wakeall(vm_shootdown_wchan, &vm_shootdown_spinlock);
+	}
+	spinlock_release(&vm_shootdown_spinlock);
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	paddr_t pa;
+	bool writeable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (faultaddress >= MIPS_KSEG2) {
+		/* Kernel virtual page; see alloc_kvpages. */
+		if (faultaddress >= KVADDR(KVPAGES_MAX) ||
+		    (kvpt[KVINDEX(faultaddress)] & PTE_VALID) == 0 ||
+		    faulttype == VM_FAULT_READONLY) {
+			return EFAULT;
+		}
+		vm_tlbload(faultaddress, kvpt[KVINDEX(faultaddress)]);
+		return 0;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	writeable = rg->rg_writeable || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	if (coremap_pin(pte)) {
+		/* Unpinning marks it referenced; see coremap_unreference. */
+		*pte &= ~PTE_NOREF;
+		if (faulttype != VM_FAULT_READ && (*pte & PTE_WRITE) == 0) {
+			/* Write to a copy-on-write or clean page. */
+			result = vm_breakcow(as, faultaddress, pte);
+			if (result) {
+				coremap_unpin(*pte & PTE_FRAME);
+				lock_release(as->as_lock);
+				return result;
+			}
+		}
+	}
+	else {
+		if (*pte & PTE_SWAPPED) {
+			/*
+			 * If it's only being read, leave it clean;
+			 * a later write fault will go through
+			 * vm_breakcow to turn on PTE_WRITE.
+			 */
+			if (faulttype == VM_FAULT_READ) {
+				writeable = false;
+			}
+			result = vm_swapin(as, faultaddress,
+					   PTE_SWAPSLOT(*pte), writeable, &pa);
+		}
+		else {
+			/* First touch: read it in or zero-fill it. */
+			result = vm_pagein(as, rg, faultaddress, &pa);
+		}
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+		*pte = pa | PTE_VALID | (writeable ? PTE_WRITE : 0);
+	}
+
+	/* Load before unpinning, or a pageout could miss our entry. */
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, *pte & PTE_FRAME);
+	vm_tlbload(faultaddress, *pte);
+	coremap_unpin(*pte & PTE_FRAME);
+
+	lock_release(as->as_lock);
+	return 0;
+}
@@ -76,6 +76,24 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Shortest timer interval we'll set, in cycles, so we don't spend all
+ * our time taking timer interrupts.
+ */
+#define MIPS_TIMER_MINCOUNT 100
+
+void
+mainbus_settimer(uint32_t nsecs)
+{
+	uint32_t count;
+
+	count = nsecs / (1000000000 / CPU_FREQUENCY);
+	if (count < MIPS_TIMER_MINCOUNT) {
+		count = MIPS_TIMER_MINCOUNT;
+	}
+	mips_timer_set(count);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
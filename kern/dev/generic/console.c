@@ -306,6 +306,8 @@ static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_frameio = NULL,
+	.devop_submit = NULL,
 };
 
 static
@@ -324,6 +326,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
+	dev->d_stats = NULL;
 
 	result = vfs_adddev("con", dev, 0);
 	if (result) {
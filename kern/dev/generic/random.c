@@ -102,6 +102,8 @@ static const struct device_ops random_devops = {
 	.devop_eachopen = randeachopen,
 	.devop_io = randio,
 	.devop_ioctl = randioctl,
+	.devop_frameio = NULL,
+	.devop_submit = NULL,
 };
 
 /*
@@ -124,6 +126,7 @@ config_random(struct random_softc *rs, int unit)
 	rs->rs_dev.d_blocks = 0;
 	rs->rs_dev.d_blocksize = 1;
 	rs->rs_dev.d_data = rs;
+	rs->rs_dev.d_stats = NULL;
 
 	/* Add the VFS device structure to the VFS device list. */
 	result = vfs_adddev("random", &rs->rs_dev, 0);
@@ -36,8 +36,11 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
 #include <platform/bus.h>
+#include <vm.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
@@ -96,15 +99,109 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the transfer of the next sector of the request in progress.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct devreq *req = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(req != NULL && req->dr_ndone < req->dr_nblocks);
+
+	/* If writing, load the data into the on-card buffer. */
+	if (req->dr_rw == UIO_WRITE) {
+		memcpy(lh->lh_buf,
+		       (char *)req->dr_data + req->dr_ndone * LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want, and start the operation. */
+	lhd_wreg(lh, LHD_REG_SECT, req->dr_block + req->dr_ndone);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Pick the next run to work on from the queue (C-LOOK): the first
+ * one at or past the last sector transferred, or if there's nothing
+ * further along, the lowest-numbered one.
+ */
+static
+void
+lhd_next(struct lhd_softc *lh)
+{
+	struct devreq **pp, **pick;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(lh->lh_cur == NULL);
+
+	if (lh->lh_queue == NULL) {
+		return;
+	}
+
+	pick = &lh->lh_queue;
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_block >= lh->lh_headpos) {
+			pick = pp;
+			break;
+		}
+	}
+	lh->lh_cur = *pick;
+	*pick = lh->lh_cur->dr_next;
+	lh->lh_cur->dr_next = NULL;
+}
+
+/*
+ * Record that a sector transfer has completed. Move on to the next
+ * sector, or if the request is finished (or failed), to the next
+ * request in its run or the next run in the queue, and start that
+ * before telling the submitter.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct devreq *req, *done = NULL;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	req = lh->lh_cur;
+	if (req == NULL) {
+		/* Nothing was running; ignore it. */
+		spinlock_release(&lh->lh_lock);
+		return;
+	}
+
+	/* If reading, get the data out of the on-card buffer. */
+	if (err == 0 && req->dr_rw == UIO_READ) {
+		membar_load_load();
+		memcpy((char *)req->dr_data + req->dr_ndone * LHD_SECTSIZE,
+		       lh->lh_buf, LHD_SECTSIZE);
+	}
+	lh->lh_headpos = req->dr_block + req->dr_ndone;
+	req->dr_ndone++;
+
+	if (err != 0 || req->dr_ndone == req->dr_nblocks) {
+		done = req;
+		lh->lh_cur = req->dr_mergenext;
+		if (lh->lh_cur == NULL) {
+			lhd_next(lh);
+		}
+	}
+	if (lh->lh_cur != NULL) {
+		lhd_start(lh);
+	}
+	if (done != NULL) {
+		diskstats_done(&lh->lh_stats, done->dr_rw, done->dr_ndone,
+			       &done->dr_queued, err);
+		done->dr_done(done, err);
+	}
+
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
@@ -133,6 +230,75 @@ lhd_irq(void *vlh)
 	}
 }
 
+/*
+ * Can REQ be done right after TAIL, as part of the same run?
+ */
+static
+bool
+lhd_adjacent(struct devreq *tail, struct devreq *req)
+{
+	return tail->dr_rw == req->dr_rw &&
+		tail->dr_block + tail->dr_nblocks == req->dr_block;
+}
+
+/*
+ * Queue a request. If it continues a waiting run, tack it on the end;
+ * if it comes right before one, put it in front; otherwise insert it
+ * in sector order. (We don't add to the run in progress, so that a
+ * steady sequential stream can't hold everyone else off forever.)
+ */
+void
+lhd_submit(struct lhd_softc *lh, struct devreq *req)
+{
+	struct devreq **pp, *run;
+
+	KASSERT(req->dr_nblocks > 0);
+	KASSERT(req->dr_done != NULL);
+
+	req->dr_ndone = 0;
+	req->dr_next = NULL;
+	req->dr_mergenext = NULL;
+	req->dr_mergetail = req;
+	gettime(&req->dr_queued);
+
+	spinlock_acquire(&lh->lh_lock);
+	diskstats_start(&lh->lh_stats);
+
+	for (pp = &lh->lh_queue; (run = *pp) != NULL; pp = &run->dr_next) {
+		if (lhd_adjacent(run->dr_mergetail, req)) {
+			/* back merge */
+			run->dr_mergetail->dr_mergenext = req;
+			run->dr_mergetail = req;
+			spinlock_release(&lh->lh_lock);
+			return;
+		}
+		if (lhd_adjacent(req, run)) {
+			/* front merge; take the run out and requeue it */
+			*pp = run->dr_next;
+			run->dr_next = NULL;
+			req->dr_mergenext = run;
+			req->dr_mergetail = run->dr_mergetail;
+			break;
+		}
+	}
+
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_block > req->dr_block) {
+			break;
+		}
+	}
+	req->dr_next = *pp;
+	*pp = req;
+
+	/* If the disk is idle, get it going. */
+	if (lh->lh_cur == NULL) {
+		lhd_next(lh);
+		lhd_start(lh);
+	}
+
+	spinlock_release(&lh->lh_lock);
+}
+
 /*
  * Function called when we are open()'d.
  */
@@ -179,8 +345,223 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Most requests lhd_io puts in the queue at once.
+ */
+#define LHD_MAXBATCH 8
+
+/*
+ * A batch of requests lhd_io is waiting for.
+ */
+struct lhd_batch {
+	struct lhd_softc *lb_lh;
+	struct devreq lb_reqs[LHD_MAXBATCH];
+	unsigned lb_pending;		/* requests not yet done */
+	int lb_result;			/* first error, if any */
+};
+
+/*
+ * Completion callback for lhd_io's requests.
+ */
+static
+void
+lhd_batch_done(struct devreq *req, int result)
+{
+	struct lhd_batch *lb = req->dr_arg;
+
+	KASSERT(lb->lb_pending > 0);
+	if (result != 0 && lb->lb_result == 0) {
+		lb->lb_result = result;
+	}
+	lb->lb_pending--;
+	if (lb->lb_pending == 0) {
+		wchan_wakeall(lb->lb_lh->lh_wchan, &lb->lb_lh->lh_lock);
+	}
+}
+
+/*
+ * Add a request to a batch.
+ */
+static
+void
+lhd_batch_add(struct lhd_batch *lb, enum uio_rw rw, uint32_t sector,
+	      uint32_t nsect, void *data)
+{
+	struct devreq *req;
+
+	KASSERT(lb->lb_pending < LHD_MAXBATCH);
+	req = &lb->lb_reqs[lb->lb_pending++];
+	req->dr_rw = rw;
+	req->dr_block = sector;
+	req->dr_nblocks = nsect;
+	req->dr_data = data;
+	req->dr_done = lhd_batch_done;
+	req->dr_arg = lb;
+}
+
+/*
+ * Submit a batch and wait for all of it to finish.
+ */
+static
+int
+lhd_batch_run(struct lhd_batch *lb)
+{
+	struct lhd_softc *lh = lb->lb_lh;
+	unsigned i, n = lb->lb_pending;
+
+	lb->lb_result = 0;
+	for (i=0; i<n; i++) {
+		lhd_submit(lh, &lb->lb_reqs[i]);
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+	while (lb->lb_pending > 0) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return lb->lb_result;
+}
+
+/*
+ * Step a uio forward over LEN bytes the disk already moved for it.
+ */
+static
+void
+lhd_uioskip(struct uio *uio, size_t len)
+{
+	struct iovec *iov;
+	size_t amt;
+
+	while (len > 0) {
+		iov = uio->uio_iov;
+		amt = iov->iov_len < len ? iov->iov_len : len;
+		iov->iov_kbase = (char *)iov->iov_kbase + amt;
+		iov->iov_len -= amt;
+		uio->uio_offset += amt;
+		uio->uio_resid -= amt;
+		len -= amt;
+		if (iov->iov_len == 0) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+		}
+	}
+}
+
+/*
+ * Can the disk transfer straight to and from the uio's buffers? Only
+ * if they're kernel memory (the copying is done in the interrupt
+ * handler) cut into whole sectors.
+ */
+static
+bool
+lhd_uio_direct(struct uio *uio)
+{
+	size_t resid = uio->uio_resid;
+	unsigned i;
+
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return false;
+	}
+	for (i=0; i<uio->uio_iovcnt && resid > 0; i++) {
+		if (uio->uio_iov[i].iov_len % LHD_SECTSIZE != 0) {
+			return false;
+		}
+		resid -= uio->uio_iov[i].iov_len < resid ?
+			uio->uio_iov[i].iov_len : resid;
+	}
+	return true;
+}
+
+/*
+ * Transfer straight to or from the uio's kernel buffers, one request
+ * per iovec, a batch at a time.
+ */
+static
+int
+lhd_io_direct(struct lhd_softc *lh, struct uio *uio, uint32_t sector)
+{
+	struct lhd_batch lb;
+	struct iovec *iov;
+	size_t batchbytes, amt;
+	unsigned i;
+	int result;
+
+	lb.lb_lh = lh;
+	while (uio->uio_resid > 0) {
+		lb.lb_pending = 0;
+		batchbytes = 0;
+		iov = uio->uio_iov;
+		for (i=0; i<uio->uio_iovcnt && i<LHD_MAXBATCH; i++) {
+			amt = iov[i].iov_len;
+			if (amt > uio->uio_resid - batchbytes) {
+				amt = uio->uio_resid - batchbytes;
+			}
+			if (amt == 0) {
+				break;
+			}
+			lhd_batch_add(&lb, uio->uio_rw,
+				      sector + batchbytes / LHD_SECTSIZE,
+				      amt / LHD_SECTSIZE, iov[i].iov_kbase);
+			batchbytes += amt;
+		}
+		KASSERT(batchbytes > 0);
+
+		result = lhd_batch_run(&lb);
+		if (result) {
+			return result;
+		}
+		lhd_uioskip(uio, batchbytes);
+		sector += batchbytes / LHD_SECTSIZE;
+	}
+	return 0;
+}
+
+/*
+ * Transfer LEN sectors one at a time through a buffer on the stack.
+ */
+static
+int
+lhd_io_bounce(struct lhd_softc *lh, struct uio *uio, uint32_t sector,
+	      uint32_t len)
+{
+	struct lhd_batch lb;
+	char buf[LHD_SECTSIZE];
+	uint32_t i;
+	int result;
+
+	lb.lb_lh = lh;
+	for (i=0; i<len; i++) {
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(buf, LHD_SECTSIZE, uio);
+			if (result) {
+				return result;
+			}
+		}
+
+		lb.lb_pending = 0;
+		lhd_batch_add(&lb, uio->uio_rw, sector+i, 1, buf);
+		result = lhd_batch_run(&lb);
+		if (result) {
+			return result;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(buf, LHD_SECTSIZE, uio);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * This queues requests and waits for them. Kernel buffers are handed
+ * to the queue as they are, several at once; anything else goes one
+ * sector at a time through a bounce buffer.
  */
 static
 int
@@ -192,9 +573,6 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,60 +585,66 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (lhd_uio_direct(uio)) {
+		return lhd_io_direct(lh, uio, sector);
 	}
+	return lhd_io_bounce(lh, uio, sector, len);
+}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
-		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
+/*
+ * Frame I/O: transfer LEN bytes at POS to or from the physical memory
+ * at PA. The interrupt handler copies each sector between the on-card
+ * buffer and the frame itself, so the data is copied only once.
+ */
+static
+int
+lhd_frameio(struct device *d, paddr_t pa, size_t len, off_t pos,
+	    enum uio_rw rw)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct lhd_batch lb;
 
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
+	uint32_t sector, nsect;
 
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+	if (pos < 0 || pos % LHD_SECTSIZE != 0 || len % LHD_SECTSIZE != 0) {
+		return EINVAL;
+	}
+	/* Don't let the sector number get truncated to 32 bits. */
+	if (pos / LHD_SECTSIZE > 0xffffffff) {
+		return EINVAL;
+	}
+	sector = pos / LHD_SECTSIZE;
+	nsect = len / LHD_SECTSIZE;
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
+	if (nsect == 0) {
+		return 0;
+	}
+	if (nsect > lh->lh_dev.d_blocks ||
+	    sector > lh->lh_dev.d_blocks - nsect) {
+		return EINVAL;
+	}
 
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
+	lb.lb_lh = lh;
+	lb.lb_pending = 0;
+	lhd_batch_add(&lb, rw, sector, nsect, (void *)PADDR_TO_KVADDR(pa));
+	return lhd_batch_run(&lb);
+}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+/*
+ * Asynchronous I/O: check the request and queue it; the interrupt
+ * handler calls its DR_DONE when it's finished.
+ */
+static
+int
+lhd_devsubmit(struct device *d, struct devreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
 
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+	if (req->dr_nblocks == 0 || req->dr_nblocks > lh->lh_dev.d_blocks ||
+	    req->dr_block > lh->lh_dev.d_blocks - req->dr_nblocks) {
+		return EINVAL;
 	}
-
+	lhd_submit(lh, req);
 	return 0;
 }
 
@@ -268,6 +652,8 @@ static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_frameio = lhd_frameio,
+	.devop_submit = lhd_devsubmit,
 };
 
 /*
@@ -284,15 +670,14 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_headpos = 0;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
 
@@ -302,6 +687,11 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
 	lh->lh_dev.d_data = lh;
+	lh->lh_dev.d_stats = &lh->lh_stats;
+
+	/* Start keeping statistics. */
+	diskstats_attach(&lh->lh_stats, name, lh->lh_dev.d_blocks,
+			 LHD_SECTSIZE);
 
 	/* Add the VFS device structure to the VFS device list. */
 	return vfs_adddev(name, &lh->lh_dev, 1);
@@ -30,13 +30,32 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
+#include <uio.h>
 #include <device.h>
+#include <diskstat.h>
+
+struct wchan;
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+/*
+ * Disk requests are struct devreqs (see <device.h>), in sectors.
+ *
+ * Requests are queued with lhd_submit, which returns at once; the
+ * disk works through the queue in elevator order, driven by the
+ * interrupt handler, and calls DR_DONE when the request is finished.
+ * DR_DONE runs in interrupt context with the queue locked, so it must
+ * not sleep or submit more requests. Requests for adjacent sectors in
+ * the same direction are merged and done back to back.
+ *
+ * Every request is counted in the disk's statistics (see
+ * <diskstat.h>) from when it's queued until DR_DONE is called.
+ */
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,9 +70,12 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the queue and registers */
+	struct devreq *lh_queue;	/* Waiting runs, sorted by sector */
+	struct devreq *lh_cur;		/* Request in progress */
+	uint32_t lh_headpos;		/* Last sector transferred */
+	struct wchan *lh_wchan;		/* For lhd_io to wait on */
+	struct diskstats lh_stats;	/* I/O statistics */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -61,4 +83,7 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/* Queue a request; see above */
+void lhd_submit(struct lhd_softc *lh, struct devreq *req);
+
 #endif /* _LAMEBUS_LHD_H_ */
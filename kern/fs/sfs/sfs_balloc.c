@@ -52,14 +52,16 @@ sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 }
 
 /*
- * Allocate a block.
+ * Allocate a block: GOAL if it's free, or else the first free block
+ * after it, so that things allocated together end up together on
+ * disk.
  */
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	result = bitmap_alloc_near(sfs->sfs_freemap, goal, diskblock);
 	if (result) {
 		return result;
 	}
@@ -78,6 +80,89 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 	return result;
 }
 
+/*
+ * Allocate a block for file SV, preferably at GOAL.
+ *
+ * A file being written sequentially asks for each block right after
+ * the last, so when we have to search we also reserve the next few
+ * free blocks after the one we find. As long as the file keeps
+ * asking for them in order it gets them, and ends up in one extent
+ * even if other files are being written at the same time.
+ *
+ * Reserved blocks are marked in use in the freemap so nobody else
+ * gets them; they go back when the file goes somewhere else, is
+ * truncated or reclaimed, or the volume is synced (so that a
+ * reservation never reaches the disk).
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	unsigned n;
+	int result;
+
+	if (sv->sv_rescount > 0 && sv->sv_resblock == goal) {
+		/* Next block of our extent */
+		block = sv->sv_resblock++;
+		sv->sv_rescount--;
+	}
+	else {
+		sfs_bunreserve(sv);
+
+		result = bitmap_alloc_near(sfs->sfs_freemap, goal, &block);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_freemapdirty = true;
+
+		if (block >= sfs->sfs_sb.sb_nblocks) {
+			panic("sfs: %s: balloc: invalid block %u\n",
+			      sfs->sfs_sb.sb_volname, block);
+		}
+
+		/* Reserve as much after it as is free, up to a point */
+		for (n = 0; n < SFS_PREALLOC; n++) {
+			if (block + 1 + n >= sfs->sfs_sb.sb_nblocks ||
+			    bitmap_isset(sfs->sfs_freemap, block + 1 + n)) {
+				break;
+			}
+			bitmap_mark(sfs->sfs_freemap, block + 1 + n);
+		}
+		sv->sv_resblock = block + 1;
+		sv->sv_rescount = n;
+	}
+
+	/* Clear block before returning it */
+	result = sfs_clearblock(sfs, block);
+	if (result) {
+		bitmap_unmark(sfs->sfs_freemap, block);
+		sfs_bunreserve(sv);
+		return result;
+	}
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Give back whatever blocks SV has reserved.
+ */
+void
+sfs_bunreserve(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	if (sv->sv_rescount == 0) {
+		return;
+	}
+	while (sv->sv_rescount > 0) {
+		sv->sv_rescount--;
+		bitmap_unmark(sfs->sfs_freemap,
+			      sv->sv_resblock + sv->sv_rescount);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
 /*
  * Free a block.
  */
@@ -39,34 +39,80 @@
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Look up (and, if GOAL isn't NULL, fill in if missing) entry INDEX
+ * of the indirect block IDBLOCK. Allocating clears the new block
+ * through the buffer cache, which is fine while we hold this buffer
+ * since it can't be the same block.
+ */
+static
+int
+sfs_bmap_entry(struct sfs_vnode *sv, daddr_t idblock, uint32_t index,
+	       daddr_t *goal, daddr_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
+	daddr_t block;
+	int result;
+
+	KASSERT(index < SFS_DBPERIDB);
+
+	result = sfs_buf_read(sfs, idblock, &idbuf);
+	if (result) {
+		return result;
+	}
+	iddata = sfs_buf_data(idbuf);
+
+	/* Get the block out of the indirect block buffer */
+	block = iddata[index];
+
+	/* If there's no block there, allocate one */
+	if (block==0 && goal != NULL) {
+		result = sfs_balloc_file(sv, *goal, &block);
+		if (result) {
+			sfs_buf_release(idbuf);
+			return result;
+		}
+		*goal = block + 1;
+
+		/* Remember the block we allocated */
+		iddata[index] = block;
+
+		/* The indirect block is now dirty */
+		sfs_buf_markdirty(idbuf, sv->sv_ino);
+	}
+	sfs_buf_release(idbuf);
+
+	*ret = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
- * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * file. If GOAL isn't NULL, allocate any blocks that are missing
+ * along the way, starting at *GOAL and updating it as we go.
+ *
+ * Past the direct blocks come the blocks mapped by the indirect
+ * block, then the doubly indirect block (an indirect block of
+ * indirect blocks), then the triply indirect block.
  */
+static
 int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+sfs_bmap_get(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *goal,
+	     daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t *idblockp;
+	uint32_t offset, span;
+	unsigned levels;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
-	/* Since we're using a static buffer, we'd better be locked. */
+	/* The inode is ours to change; we'd better be locked. */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/*
@@ -81,11 +127,12 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		/*
 		 * Do we need to allocate?
 		 */
-		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+		if (block==0 && goal != NULL) {
+			result = sfs_balloc_file(sv, *goal, &block);
 			if (result) {
 				return result;
 			}
+			*goal = block + 1;
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
@@ -105,29 +152,33 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block. Figure out which of the indirect
+	 * trees it's in, and OFFSET, its block number within the
+	 * region that tree maps.
 	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum >= SFS_NINDIRECT) {
+	offset = fileblock - SFS_NDIRECT;
+	if (offset < SFS_DBPERIDB) {
+		idblockp = &sv->sv_i.sfi_indirect;
+		levels = 1;
+	}
+	else if ((offset -= SFS_DBPERIDB) < SFS_DBPERIDB * SFS_DBPERIDB) {
+		idblockp = &sv->sv_i.sfi_dindirect;
+		levels = 2;
+	}
+	else if ((offset -= SFS_DBPERIDB * SFS_DBPERIDB) <
+		 SFS_DBPERIDB * SFS_DBPERIDB * SFS_DBPERIDB) {
+		idblockp = &sv->sv_i.sfi_tindirect;
+		levels = 3;
+	}
+	else {
+		/* Too large for us to handle */
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	block = *idblockp;
 
-	if (idblock==0 && !doalloc) {
+	if (block==0 && goal == NULL) {
 		/*
 		 * There's no indirect block allocated. We weren't
 		 * asked to allocate anything, so pretend the indirect
@@ -136,64 +187,169 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		*diskblock = 0;
 		return 0;
 	}
-	else if (idblock==0) {
+	else if (block==0) {
 		/*
 		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * allocate a block whose number needs to be stored
+		 * under it. Thus, we need to allocate an indirect
+		 * block. (sfs_balloc zeroes it.)
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc_file(sv, *goal, &block);
 		if (result) {
 			return result;
 		}
+		*goal = block + 1;
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*idblockp = block;
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
+	}
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	/*
+	 * Walk down the tree. At each level, SPAN is the number of
+	 * file blocks each entry maps.
+	 */
+	span = 1;
+	while (--levels > 0) {
+		span *= SFS_DBPERIDB;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	while (block != 0) {
+		result = sfs_bmap_entry(sv, block, offset / span, goal,
+					&block);
 		if (result) {
 			return result;
 		}
+		if (span == 1) {
+			break;
+		}
+		offset %= span;
+		span /= SFS_DBPERIDB;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/* Hand back the result and return. */
+	if (block != 0 && !sfs_bused(sfs, block)) {
+		panic("sfs: %s: Data block %u (block %u of file %u) "
+		      "marked free\n", sfs->sfs_sb.sb_volname,
+		      block, fileblock, sv->sv_ino);
+	}
+	*diskblock = block;
+	return 0;
+}
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+/*
+ * Look up the disk block number (from 0 up to the number of blocks on
+ * the disk) given a file and the logical block number within that
+ * file. If DOALLOC is set, and no such block exists, one will be
+ * allocated.
+ *
+ * New blocks go right after the previous block of the file if it has
+ * one, or else right after the inode, so files stay contiguous.
+ */
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	daddr_t goal, prev;
+	int result;
+
+	result = sfs_bmap_get(sv, fileblock, NULL, diskblock);
+	if (result || *diskblock != 0 || !doalloc) {
+		return result;
+	}
+
+	goal = sv->sv_ino + 1;
+	if (fileblock > 0) {
+		result = sfs_bmap_get(sv, fileblock - 1, NULL, &prev);
 		if (result) {
 			return result;
 		}
+		if (prev != 0) {
+			goal = prev + 1;
+		}
+	}
+	return sfs_bmap_get(sv, fileblock, &goal, diskblock);
+}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+/*
+ * Truncation helper: discard everything at or past file block
+ * BLOCKLEN under the indirect block *IDBLOCKP, whose entries each map
+ * SPAN file blocks starting from file block BASE. If that empties it,
+ * free it too and clear *IDBLOCKP.
+ */
+static
+int
+sfs_itrunc_indirect(struct sfs_vnode *sv, uint32_t *idblockp,
+		    uint32_t span, uint32_t base, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
+	uint32_t j, entrybase;
+	bool hasnonzero, iddirty;
+	int result;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+	if (*idblockp == 0 || base + span * SFS_DBPERIDB <= blocklen) {
+		/* Nothing here, or nothing we're getting rid of */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_buf_read(sfs, *idblockp, &idbuf);
+	if (result) {
+		return result;
+	}
+	iddata = sfs_buf_data(idbuf);
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		entrybase = base + j * span;
+
+		/* Discard any blocks that are past the new EOF */
+		if (iddata[j] != 0 && span == 1 && entrybase >= blocklen) {
+			sfs_bfree(sfs, iddata[j]);
+			iddata[j] = 0;
+			iddirty = true;
+		}
+		else if (iddata[j] != 0 && span > 1) {
+			/* ...or past it under a lower indirect block */
+			uint32_t entry = iddata[j];
+
+			result = sfs_itrunc_indirect(sv, &entry,
+						     span / SFS_DBPERIDB,
+						     entrybase, blocklen);
+			if (result) {
+				sfs_buf_release(idbuf);
+				return result;
+			}
+			if (entry != iddata[j]) {
+				iddata[j] = entry;
+				iddirty = true;
+			}
+		}
+
+		/* Remember if we see any nonzero blocks in here */
+		if (iddata[j] != 0) {
+			hasnonzero = true;
 		}
 	}
 
-	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: %s: Data block %u (block %u of file %u) "
-		      "marked free\n", sfs->sfs_sb.sb_volname,
-		      block, fileblock, sv->sv_ino);
+	if (!hasnonzero) {
+		/*
+		 * The whole indirect block is empty now; free it.
+		 * (The buffer still holds what's on disk, but the
+		 * block is now free, so nobody will care.)
+		 */
+		sfs_bfree(sfs, *idblockp);
+		*idblockp = 0;
 	}
-	*diskblock = block;
+	else if (iddirty) {
+		/* The indirect block is dirty */
+		sfs_buf_markdirty(idbuf, sv->sv_ino);
+	}
+	sfs_buf_release(idbuf);
 	return 0;
 }
 
@@ -203,30 +359,22 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i;
+	daddr_t block;
+	uint32_t *idblockp, oldidblock;
+	uint32_t span, base;
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
 	vfs_biglock_acquire();
 
+	/* The file won't be continuing where it left off. */
+	sfs_bunreserve(sv);
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -240,55 +388,32 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
+	/*
+	 * Then the indirect, doubly indirect, and triply indirect
+	 * trees, in that order.
+	 */
+	base = SFS_NDIRECT;
+	span = 1;
+	for (i=0; i<3; i++) {
+		switch (i) {
+		    case 0: idblockp = &sv->sv_i.sfi_indirect; break;
+		    case 1: idblockp = &sv->sv_i.sfi_dindirect; break;
+		    default: idblockp = &sv->sv_i.sfi_tindirect; break;
+		}
 
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		oldidblock = *idblockp;
+		result = sfs_itrunc_indirect(sv, idblockp, span, base,
+					     blocklen);
+		if (*idblockp != oldidblock) {
+			sv->sv_dirty = true;
+		}
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
 
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+		base += span * SFS_DBPERIDB;
+		span *= SFS_DBPERIDB;
 	}
 
 	/* Set the file size */
@@ -300,4 +425,3 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	vfs_biglock_release();
 	return 0;
 }
-
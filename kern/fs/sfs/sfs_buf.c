@@ -0,0 +1,1302 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * SFS filesystem
+ *
+ * Buffer cache.
+ *
+ * All block I/O goes through a cache of block-sized buffers, shared
+ * by all mounted SFS volumes and looked up by volume and block number
+ * in a hash table. A buffer is handed out held (its reference count
+ * keeps it in the cache) and busy (nobody else can touch its contents
+ * until it is released). Buffers nobody holds are kept on an LRU list
+ * and reused oldest first once the cache has grown to its limit,
+ * which is a fixed fraction of physical memory.
+ *
+ * Writes are delayed: sfs_buf_markdirty only notes that the buffer
+ * needs writing and which file it belongs to. Dirty buffers are kept
+ * on a list in the order they were first dirtied, and written back
+ * by the syncer thread once they are old enough or once too much of
+ * the cache is dirty, by sfs_buf_flushfile/sfs_buf_flushall for
+ * fsync and sync, or when their buffer is about to be reused.
+ *
+ * Runs of consecutive blocks are read and written with one disk
+ * transfer each where possible (up to SFS_MAXCLUSTER blocks).
+ *
+ * Reads can also be done ahead of time: sfs_buf_readahead queues a
+ * block for the read-ahead thread to bring into the cache, so that a
+ * sequential reader finds it there (or already on its way) instead
+ * of waiting for the disk each time.
+ *
+ * If the device can do transfers in the background (devop_submit),
+ * the read-ahead thread and the syncer hand it all their transfers
+ * at once and go on without waiting, so the disk can sort them; each
+ * buffer stays held and busy until its transfer is done, and is let
+ * go of by the completion callback.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <thread.h>
+#include <mainbus.h>
+#include <uio.h>
+#include <device.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Use at most 1/SFS_BUF_MEMFRACTION of RAM for buffers. */
+#define SFS_BUF_MEMFRACTION	16
+
+/* Enough for a few threads to each hold a whole cluster. */
+#define SFS_BUF_MINBUFS		(4 * SFS_MAXCLUSTER)
+
+/* Number of hash buckets; must be a power of two. */
+#define SFS_BUF_HASHSIZE	256
+
+/* How far down the LRU list to look for a clean buffer to reuse. */
+#define SFS_BUF_SCANMAX		32
+
+/*
+ * Syncer parameters: it runs every SFS_SYNCER_PERIOD seconds and
+ * writes back buffers that have been dirty for SFS_BUF_MAXAGE seconds
+ * or more. If more than 1/SFS_BUF_HIWATER_DIV of the cache is dirty
+ * it also writes back the oldest until only 1/SFS_BUF_LOWATER_DIV is.
+ */
+#define SFS_SYNCER_PERIOD	1
+#define SFS_BUF_MAXAGE		5
+#define SFS_BUF_HIWATER_DIV	2
+#define SFS_BUF_LOWATER_DIV	4
+
+/* Most read-ahead requests we'll queue; more are dropped. */
+#define SFS_RA_QUEUESIZE	64
+
+struct sfs_buf {
+	struct sfs_fs *b_fs;		/* volume, or NULL if unused */
+	daddr_t b_block;		/* block number on the volume */
+	void *b_data;			/* SFS_BLOCKSIZE bytes */
+	unsigned b_refcount;		/* holders */
+	bool b_busy;			/* contents in use by a holder */
+	bool b_valid;			/* contents match the block */
+	bool b_dirty;			/* contents need writing */
+	uint32_t b_ino;			/* file it was dirtied for, or 0 */
+	time_t b_dirtytime;		/* when it was first dirtied */
+	bool b_writefailed;		/* last background write failed */
+	struct devreq b_req;		/* for background transfers */
+	struct sfs_buf *b_hashnext;	/* hash chain */
+	struct sfs_buf *b_lruprev;	/* LRU list, if b_refcount is 0 */
+	struct sfs_buf *b_lrunext;
+	struct sfs_buf *b_dirtyprev;	/* dirty list, if b_dirty */
+	struct sfs_buf *b_dirtynext;
+};
+
+/*
+ * Everything except buffer contents is protected by sfs_buflock;
+ * contents belong to whoever has the buffer busy. Anyone waiting for
+ * a busy buffer, or for a buffer to be let go of, sleeps on
+ * sfs_bufwchan.
+ */
+static struct spinlock sfs_buflock = SPINLOCK_INITIALIZER;
+static struct wchan *sfs_bufwchan;
+
+static struct sfs_buf *sfs_bufhash[SFS_BUF_HASHSIZE];
+static struct sfs_buf *sfs_buflru_head;		/* reuse first */
+static struct sfs_buf *sfs_buflru_tail;		/* most recently used */
+static struct sfs_buf *sfs_bufdirty_head;	/* dirty longest */
+static struct sfs_buf *sfs_bufdirty_tail;
+static unsigned sfs_nbufs;
+static unsigned sfs_nlru;			/* buffers nobody holds */
+static unsigned sfs_maxbufs;
+static unsigned sfs_ndirty;
+static unsigned sfs_dirty_hiwater;
+static unsigned sfs_dirty_lowater;
+static unsigned sfs_nwriting;		/* dirty, being written back */
+static unsigned sfs_nreading;		/* being read ahead */
+
+/*
+ * Read-ahead queue, a ring, also protected by sfs_buflock. The
+ * read-ahead thread sleeps on sfs_rawchan for it to be nonempty.
+ * sfs_racurrent is the volume the thread is reading from, if any, so
+ * unmount can wait for it.
+ */
+struct sfs_rareq {
+	struct sfs_fs *ra_fs;
+	daddr_t ra_block;
+};
+static struct sfs_rareq sfs_raqueue[SFS_RA_QUEUESIZE];
+static unsigned sfs_rahead;
+static unsigned sfs_racount;
+static struct sfs_fs *sfs_racurrent;
+static struct wchan *sfs_rawchan;
+
+#define SFS_BUF_HASH(sfs, block) \
+	((((uintptr_t)(sfs) >> 6) ^ (block)) & (SFS_BUF_HASHSIZE - 1))
+
+static int sfs_buf_dogetrun(struct sfs_fs *sfs, daddr_t block, unsigned n,
+			    bool wait, struct sfs_buf **bufs, unsigned *got);
+
+/*
+ * Whether it's worth waiting for a buffer to be let go of: there are
+ * fewer than N to be had right now, but some are held (so will come
+ * back). Called with sfs_buflock held.
+ */
+#define SFS_BUF_SHORT(n) \
+	(sfs_nlru + (sfs_maxbufs - sfs_nbufs) < (n) && sfs_nlru < sfs_nbufs)
+
+////////////////////////////////////////////////////////////
+// Lists
+
+static
+void
+sfs_buf_lru_remove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(sfs_buflru_head == b);
+		sfs_buflru_head = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(sfs_buflru_tail == b);
+		sfs_buflru_tail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+	KASSERT(sfs_nlru > 0);
+	sfs_nlru--;
+}
+
+/*
+ * Put an unheld buffer on the LRU list: at the end, normally, or at
+ * the front if its contents aren't worth keeping.
+ */
+static
+void
+sfs_buf_lru_add(struct sfs_buf *b, bool keep)
+{
+	if (keep) {
+		b->b_lruprev = sfs_buflru_tail;
+		b->b_lrunext = NULL;
+		if (sfs_buflru_tail != NULL) {
+			sfs_buflru_tail->b_lrunext = b;
+		}
+		else {
+			sfs_buflru_head = b;
+		}
+		sfs_buflru_tail = b;
+	}
+	else {
+		b->b_lruprev = NULL;
+		b->b_lrunext = sfs_buflru_head;
+		if (sfs_buflru_head != NULL) {
+			sfs_buflru_head->b_lruprev = b;
+		}
+		else {
+			sfs_buflru_tail = b;
+		}
+		sfs_buflru_head = b;
+	}
+	sfs_nlru++;
+}
+
+static
+void
+sfs_buf_dirty_remove(struct sfs_buf *b)
+{
+	if (b->b_dirtyprev != NULL) {
+		b->b_dirtyprev->b_dirtynext = b->b_dirtynext;
+	}
+	else {
+		KASSERT(sfs_bufdirty_head == b);
+		sfs_bufdirty_head = b->b_dirtynext;
+	}
+	if (b->b_dirtynext != NULL) {
+		b->b_dirtynext->b_dirtyprev = b->b_dirtyprev;
+	}
+	else {
+		KASSERT(sfs_bufdirty_tail == b);
+		sfs_bufdirty_tail = b->b_dirtyprev;
+	}
+	b->b_dirtyprev = b->b_dirtynext = NULL;
+}
+
+static
+void
+sfs_buf_dirty_add(struct sfs_buf *b)
+{
+	b->b_dirtyprev = sfs_bufdirty_tail;
+	b->b_dirtynext = NULL;
+	if (sfs_bufdirty_tail != NULL) {
+		sfs_bufdirty_tail->b_dirtynext = b;
+	}
+	else {
+		sfs_bufdirty_head = b;
+	}
+	sfs_bufdirty_tail = b;
+}
+
+static
+struct sfs_buf *
+sfs_buf_hash_find(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = sfs_bufhash[SFS_BUF_HASH(sfs, block)]; b != NULL;
+	     b = b->b_hashnext) {
+		if (b->b_fs == sfs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_buf_hash_insert(struct sfs_buf *b)
+{
+	unsigned h;
+
+	h = SFS_BUF_HASH(b->b_fs, b->b_block);
+	b->b_hashnext = sfs_bufhash[h];
+	sfs_bufhash[h] = b;
+}
+
+static
+void
+sfs_buf_hash_remove(struct sfs_buf *b)
+{
+	struct sfs_buf **bp;
+
+	bp = &sfs_bufhash[SFS_BUF_HASH(b->b_fs, b->b_block)];
+	while (*bp != b) {
+		KASSERT(*bp != NULL);
+		bp = &(*bp)->b_hashnext;
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Buffers
+
+/*
+ * Allocate a new, unused buffer. Doesn't touch any shared state.
+ */
+static
+struct sfs_buf *
+sfs_buf_create(void)
+{
+	struct sfs_buf *b;
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(SFS_BLOCKSIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_fs = NULL;
+	b->b_block = 0;
+	b->b_refcount = 0;
+	b->b_busy = false;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_ino = 0;
+	b->b_dirtytime = 0;
+	b->b_writefailed = false;
+	b->b_hashnext = NULL;
+	b->b_lruprev = b->b_lrunext = NULL;
+	b->b_dirtyprev = b->b_dirtynext = NULL;
+	return b;
+}
+
+/*
+ * Take hold of a buffer and wait until it's ours. Called with
+ * sfs_buflock held.
+ */
+static
+void
+sfs_buf_hold(struct sfs_buf *b)
+{
+	if (b->b_refcount == 0) {
+		sfs_buf_lru_remove(b);
+	}
+	b->b_refcount++;
+	while (b->b_busy) {
+		wchan_sleep(sfs_bufwchan, &sfs_buflock);
+	}
+	b->b_busy = true;
+}
+
+/*
+ * Let go of a buffer. Called with sfs_buflock held.
+ */
+static
+void
+sfs_buf_unhold(struct sfs_buf *b)
+{
+	KASSERT(b->b_busy);
+	KASSERT(b->b_refcount > 0);
+	b->b_busy = false;
+	b->b_refcount--;
+	if (b->b_refcount == 0) {
+		sfs_buf_lru_add(b, b->b_valid);
+	}
+	wchan_wakeall(sfs_bufwchan, &sfs_buflock);
+}
+
+/*
+ * Move the contents of the N busy buffers in BUFS, which must be for
+ * consecutive blocks of one volume, to or from disk in one transfer.
+ */
+static
+int
+sfs_buf_transfer(struct sfs_buf **bufs, unsigned n, enum uio_rw rw)
+{
+	struct iovec iov[SFS_MAXCLUSTER];
+	struct uio ku;
+	unsigned i;
+
+	KASSERT(n > 0 && n <= SFS_MAXCLUSTER);
+
+	for (i=0; i<n; i++) {
+		KASSERT(bufs[i]->b_busy);
+		KASSERT(bufs[i]->b_fs == bufs[0]->b_fs);
+		KASSERT(bufs[i]->b_block == bufs[0]->b_block + i);
+		iov[i].iov_kbase = bufs[i]->b_data;
+		iov[i].iov_len = SFS_BLOCKSIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = ((off_t)bufs[0]->b_block) * SFS_BLOCKSIZE;
+	ku.uio_resid = n * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+
+	return sfs_rwblock(bufs[0]->b_fs, &ku);
+}
+
+/*
+ * Write a busy, dirty buffer back to disk, along with any dirty
+ * buffers nobody is using for the blocks right after it, so that a
+ * sequentially written file goes out in as few transfers as
+ * possible. If that fails they stay dirty, but go to the back of the
+ * dirty list so the syncer tries everything else before it tries
+ * them again.
+ */
+static
+int
+sfs_buf_flush(struct sfs_buf *b)
+{
+	struct sfs_buf *bufs[SFS_MAXCLUSTER], *nb;
+	struct timespec now;
+	unsigned n, i;
+	int result;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dirty);
+	KASSERT(b->b_fs->sfs_device != NULL);
+
+	bufs[0] = b;
+	spinlock_acquire(&sfs_buflock);
+	for (n = 1; n < SFS_MAXCLUSTER; n++) {
+		nb = sfs_buf_hash_find(b->b_fs, b->b_block + n);
+		if (nb == NULL || !nb->b_dirty || nb->b_refcount > 0) {
+			break;
+		}
+		sfs_buf_hold(nb);
+		bufs[n] = nb;
+	}
+	spinlock_release(&sfs_buflock);
+
+	result = sfs_buf_transfer(bufs, n, UIO_WRITE);
+	if (result) {
+		gettime(&now);
+	}
+
+	spinlock_acquire(&sfs_buflock);
+	for (i=0; i<n; i++) {
+		sfs_buf_dirty_remove(bufs[i]);
+		if (result) {
+			bufs[i]->b_dirtytime = now.tv_sec;
+			sfs_buf_dirty_add(bufs[i]);
+		}
+		else {
+			bufs[i]->b_dirty = false;
+			sfs_ndirty--;
+		}
+		bufs[i]->b_writefailed = false;
+		if (i > 0) {
+			/* (the caller holds the first) */
+			sfs_buf_unhold(bufs[i]);
+		}
+	}
+	spinlock_release(&sfs_buflock);
+
+	return result;
+}
+
+/*
+ * Completion callback for sfs_buf_startflush, in interrupt context.
+ * If the write failed the buffer stays dirty and goes to the back of
+ * the dirty list, as in sfs_buf_flush; the syncer then writes it with
+ * sfs_buf_flush, which retries and complains.
+ */
+static
+void
+sfs_buf_writedone(struct devreq *req, int result)
+{
+	struct sfs_buf *b = req->dr_arg;
+	struct timespec now;
+
+	if (result) {
+		gettime(&now);
+	}
+
+	spinlock_acquire(&sfs_buflock);
+	KASSERT(sfs_nwriting > 0);
+	sfs_nwriting--;
+	sfs_buf_dirty_remove(b);
+	if (result) {
+		b->b_dirtytime = now.tv_sec;
+		b->b_writefailed = true;
+		sfs_buf_dirty_add(b);
+	}
+	else {
+		b->b_dirty = false;
+		b->b_writefailed = false;
+		sfs_ndirty--;
+	}
+	sfs_buf_unhold(b);
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Like sfs_buf_flush, but start the writes in the background and
+ * return at once. Each buffer, including B, which the caller holds,
+ * is let go of when its write is done.
+ */
+static
+void
+sfs_buf_startflush(struct sfs_buf *b)
+{
+	struct sfs_buf *bufs[SFS_MAXCLUSTER], *nb;
+	unsigned n, i;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dirty);
+	KASSERT(b->b_fs->sfs_device != NULL);
+
+	bufs[0] = b;
+	spinlock_acquire(&sfs_buflock);
+	for (n = 1; n < SFS_MAXCLUSTER; n++) {
+		nb = sfs_buf_hash_find(b->b_fs, b->b_block + n);
+		if (nb == NULL || !nb->b_dirty || nb->b_refcount > 0) {
+			break;
+		}
+		sfs_buf_hold(nb);
+		bufs[n] = nb;
+	}
+	sfs_nwriting += n;
+	spinlock_release(&sfs_buflock);
+
+	for (i=0; i<n; i++) {
+		sfs_startio(bufs[i]->b_fs, bufs[i]->b_block, bufs[i]->b_data,
+			    UIO_WRITE, &bufs[i]->b_req, sfs_buf_writedone,
+			    bufs[i]);
+	}
+}
+
+/*
+ * Read in whichever of the N busy buffers in BUFS, which must be for
+ * consecutive blocks of one volume, don't have their blocks yet, a
+ * run of them at a time.
+ */
+static
+int
+sfs_buf_fillrun(struct sfs_buf **bufs, unsigned n)
+{
+	unsigned i, j, k;
+	int result;
+
+	for (i=0; i<n; i=j) {
+		if (bufs[i]->b_valid) {
+			j = i+1;
+			continue;
+		}
+		for (j=i+1; j<n && !bufs[j]->b_valid; j++) {
+			/* nothing */
+		}
+		result = sfs_buf_transfer(&bufs[i], j-i, UIO_READ);
+		if (result) {
+			return result;
+		}
+		for (k=i; k<j; k++) {
+			bufs[k]->b_valid = true;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Completion callback for sfs_buf_startfill, in interrupt context.
+ * If the read failed, never mind; it was only read-ahead.
+ */
+static
+void
+sfs_buf_readdone(struct devreq *req, int result)
+{
+	struct sfs_buf *b = req->dr_arg;
+
+	spinlock_acquire(&sfs_buflock);
+	KASSERT(sfs_nreading > 0);
+	sfs_nreading--;
+	if (result == 0) {
+		b->b_valid = true;
+	}
+	sfs_buf_unhold(b);
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Like sfs_buf_fillrun, but start the reads in the background and
+ * return at once, and let go of each of the buffers (which are taken
+ * from the caller) when it's been read, or right away if it didn't
+ * need to be.
+ */
+static
+void
+sfs_buf_startfill(struct sfs_buf **bufs, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (bufs[i]->b_valid) {
+			sfs_buf_release(bufs[i]);
+			continue;
+		}
+		spinlock_acquire(&sfs_buflock);
+		sfs_nreading++;
+		spinlock_release(&sfs_buflock);
+		sfs_startio(bufs[i]->b_fs, bufs[i]->b_block, bufs[i]->b_data,
+			    UIO_READ, &bufs[i]->b_req, sfs_buf_readdone,
+			    bufs[i]);
+	}
+}
+
+/*
+ * Write back the dirty buffers on SFS that are selected by ALL and
+ * INO (see below). Stops at the first error.
+ */
+static
+int
+sfs_buf_flushsome(struct sfs_fs *sfs, bool all, uint32_t ino)
+{
+	struct sfs_buf *b;
+	int result;
+
+	spinlock_acquire(&sfs_buflock);
+	b = sfs_bufdirty_head;
+	while (b != NULL) {
+		/*
+		 * A file's buffers are the ones dirtied on its behalf
+		 * plus its inode, whose block number is its inode
+		 * number.
+		 */
+		if (b->b_fs != sfs ||
+		    (!all && b->b_ino != ino && b->b_block != ino)) {
+			b = b->b_dirtynext;
+			continue;
+		}
+
+		sfs_buf_hold(b);
+		if (b->b_dirty) {
+			spinlock_release(&sfs_buflock);
+			result = sfs_buf_flush(b);
+			spinlock_acquire(&sfs_buflock);
+		}
+		else {
+			/* The syncer got it while we waited. */
+			result = 0;
+		}
+		sfs_buf_unhold(b);
+		if (result) {
+			spinlock_release(&sfs_buflock);
+			return result;
+		}
+
+		/* The list may have changed meanwhile; start over. */
+		b = sfs_bufdirty_head;
+	}
+	spinlock_release(&sfs_buflock);
+	return 0;
+}
+
+/*
+ * One pass of the syncer.
+ */
+static
+void
+sfs_buf_syncpass(void)
+{
+	struct sfs_buf *b;
+	struct timespec now;
+	unsigned limit;
+	bool drain;
+
+	gettime(&now);
+
+	spinlock_acquire(&sfs_buflock);
+
+	/* Anything that fails goes around again, so bound the pass. */
+	limit = sfs_ndirty;
+	drain = sfs_ndirty > sfs_dirty_hiwater;
+
+	b = sfs_bufdirty_head;
+	while (b != NULL && limit > 0) {
+		if (now.tv_sec - b->b_dirtytime < SFS_BUF_MAXAGE &&
+		    !(drain && sfs_ndirty - sfs_nwriting > sfs_dirty_lowater)) {
+			/* The rest are younger still. */
+			break;
+		}
+		if (b->b_refcount > 0) {
+			/* Someone's using it; get it next time. */
+			b = b->b_dirtynext;
+			continue;
+		}
+
+		sfs_buf_hold(b);
+		spinlock_release(&sfs_buflock);
+		if (sfs_canasyncio(b->b_fs) && !b->b_writefailed) {
+			/* this lets go of b when it's done */
+			sfs_buf_startflush(b);
+			spinlock_acquire(&sfs_buflock);
+		}
+		else {
+			/* sfs_rwblock complains about errors for us */
+			(void)sfs_buf_flush(b);
+			spinlock_acquire(&sfs_buflock);
+			sfs_buf_unhold(b);
+		}
+
+		limit--;
+		b = sfs_bufdirty_head;
+	}
+
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * The syncer thread.
+ *
+ * It doesn't need the vfs big lock: the buffers it writes are busy
+ * while it writes them, and a volume can't be unmounted until all
+ * its buffers are both clean and let go of.
+ */
+static
+void
+sfs_syncer(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		clocksleep(SFS_SYNCER_PERIOD);
+		sfs_buf_syncpass();
+	}
+}
+
+/*
+ * The read-ahead thread. Like the syncer it doesn't need the big
+ * lock; unmount waits for it to be done with the volume.
+ */
+static
+void
+sfs_readaheadd(void *data1, unsigned long data2)
+{
+	struct sfs_buf *bufs[SFS_MAXCLUSTER];
+	struct sfs_fs *sfs;
+	daddr_t block;
+	unsigned n, got, i;
+	int result;
+
+	(void)data1;
+	(void)data2;
+
+	spinlock_acquire(&sfs_buflock);
+	while (1) {
+		while (sfs_racount == 0) {
+			wchan_sleep(sfs_rawchan, &sfs_buflock);
+		}
+
+		/* Take along whatever's queued for the next blocks too. */
+		sfs = sfs_raqueue[sfs_rahead].ra_fs;
+		block = sfs_raqueue[sfs_rahead].ra_block;
+		n = 0;
+		while (sfs_racount > 0 && n < SFS_MAXCLUSTER &&
+		       sfs_raqueue[sfs_rahead].ra_fs == sfs &&
+		       sfs_raqueue[sfs_rahead].ra_block == block + n) {
+			sfs_rahead = (sfs_rahead + 1) % SFS_RA_QUEUESIZE;
+			sfs_racount--;
+			n++;
+		}
+		sfs_racurrent = sfs;
+		spinlock_release(&sfs_buflock);
+
+		/*
+		 * Don't wait for buffers past the first: we're in no
+		 * hurry, and whoever has them busy might want the
+		 * first.
+		 */
+		result = sfs_buf_dogetrun(sfs, block, n, false, bufs, &got);
+		if (result == 0 && sfs_canasyncio(sfs)) {
+			sfs_buf_startfill(bufs, got);
+		}
+		else if (result == 0) {
+			(void)sfs_buf_fillrun(bufs, got);
+			for (i=0; i<got; i++) {
+				sfs_buf_release(bufs[i]);
+			}
+		}
+
+		spinlock_acquire(&sfs_buflock);
+		sfs_racurrent = NULL;
+		wchan_wakeall(sfs_bufwchan, &sfs_buflock);
+	}
+}
+
+/*
+ * Set up the buffer cache and start the syncer and read-ahead
+ * threads. Called on each mount (mounts are serialized by the big
+ * lock); only the first call does anything.
+ */
+int
+sfs_buf_bootstrap(void)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs_bufwchan != NULL) {
+		return 0;
+	}
+
+	sfs_maxbufs = mainbus_ramsize() / SFS_BUF_MEMFRACTION / SFS_BLOCKSIZE;
+	if (sfs_maxbufs < SFS_BUF_MINBUFS) {
+		sfs_maxbufs = SFS_BUF_MINBUFS;
+	}
+	sfs_dirty_hiwater = sfs_maxbufs / SFS_BUF_HIWATER_DIV;
+	sfs_dirty_lowater = sfs_maxbufs / SFS_BUF_LOWATER_DIV;
+
+	sfs_rawchan = wchan_create("sfs_readahead");
+	if (sfs_rawchan == NULL) {
+		return ENOMEM;
+	}
+	sfs_bufwchan = wchan_create("sfs_buf");
+	if (sfs_bufwchan == NULL) {
+		wchan_destroy(sfs_rawchan);
+		sfs_rawchan = NULL;
+		return ENOMEM;
+	}
+
+	result = thread_fork("sfs_syncer", NULL, sfs_syncer, NULL, 0);
+	if (result) {
+		panic("sfs: cannot start syncer: %s\n", strerror(result));
+	}
+	result = thread_fork("sfs_readahead", NULL, sfs_readaheadd, NULL, 0);
+	if (result) {
+		panic("sfs: cannot start read-ahead thread: %s\n",
+		      strerror(result));
+	}
+
+	return 0;
+}
+
+/*
+ * Find or make a buffer for BLOCK of SFS and hand it back held and
+ * busy. Its contents are whatever the cache has, which may be
+ * nothing (b_valid false). If WAIT is false and someone else has the
+ * buffer busy, fail with EAGAIN instead of waiting.
+ *
+ * If every buffer is held, wait for one to be let go of. Unless WAIT
+ * is false, that is, or HOLDING is set, meaning the caller has other
+ * buffers held already: waiting then could deadlock against someone
+ * doing the same, so fail with EAGAIN and let the caller sort it out.
+ */
+static
+int
+sfs_buf_doget(struct sfs_fs *sfs, daddr_t block, bool wait, bool holding,
+	      struct sfs_buf **ret)
+{
+	struct sfs_buf *b, *newb;
+	unsigned n;
+	int result;
+
+	KASSERT(sfs_bufwchan != NULL);
+
+	spinlock_acquire(&sfs_buflock);
+ again:
+	b = sfs_buf_hash_find(sfs, block);
+	if (b != NULL) {
+		if (b->b_busy && !wait) {
+			spinlock_release(&sfs_buflock);
+			return EAGAIN;
+		}
+		sfs_buf_hold(b);
+		spinlock_release(&sfs_buflock);
+		*ret = b;
+		return 0;
+	}
+
+	if (sfs_nbufs < sfs_maxbufs) {
+		/* Grow the cache. */
+		sfs_nbufs++;
+		spinlock_release(&sfs_buflock);
+		newb = sfs_buf_create();
+		spinlock_acquire(&sfs_buflock);
+		if (newb == NULL) {
+			sfs_nbufs--;
+		}
+		else {
+			/* Park it; someone may have made ours meanwhile. */
+			sfs_buf_lru_add(newb, false);
+			goto again;
+		}
+	}
+
+	/* Reuse the least recently used clean buffer. */
+	b = sfs_buflru_head;
+	for (n = 0; b != NULL && b->b_dirty && n < SFS_BUF_SCANMAX; n++) {
+		b = b->b_lrunext;
+	}
+	if (b == NULL || b->b_dirty) {
+		b = sfs_buflru_head;
+		if (b == NULL) {
+			if (sfs_nbufs == 0) {
+				/* There are none to wait for. */
+				spinlock_release(&sfs_buflock);
+				return ENOMEM;
+			}
+			if (!wait || holding) {
+				spinlock_release(&sfs_buflock);
+				return EAGAIN;
+			}
+			wchan_sleep(sfs_bufwchan, &sfs_buflock);
+			goto again;
+		}
+		if (!b->b_dirty) {
+			/* (the scan ran off the end of a short list) */
+			goto reuse;
+		}
+
+		/*
+		 * Everything old is dirty; the syncer is behind.
+		 * Clean the oldest ourselves, then put it where it'll
+		 * be found first and look again, since we've given up
+		 * the lock for a while.
+		 */
+		sfs_buf_hold(b);
+		spinlock_release(&sfs_buflock);
+		result = sfs_buf_flush(b);
+		spinlock_acquire(&sfs_buflock);
+		sfs_buf_unhold(b);
+		if (result) {
+			spinlock_release(&sfs_buflock);
+			return result;
+		}
+		if (b->b_refcount == 0) {
+			sfs_buf_lru_remove(b);
+			sfs_buf_lru_add(b, false);
+		}
+		goto again;
+	}
+
+ reuse:
+	KASSERT(b->b_refcount == 0);
+	KASSERT(!b->b_busy);
+	KASSERT(!b->b_dirty);
+	sfs_buf_lru_remove(b);
+	if (b->b_fs != NULL) {
+		sfs_buf_hash_remove(b);
+	}
+
+	b->b_fs = sfs;
+	b->b_block = block;
+	b->b_valid = false;
+	b->b_ino = 0;
+	b->b_refcount = 1;
+	b->b_busy = true;
+	sfs_buf_hash_insert(b);
+	spinlock_release(&sfs_buflock);
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get a buffer for BLOCK of SFS, held and busy, with whatever the
+ * cache has in it.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_doget(sfs, block, true, false, ret);
+}
+
+/*
+ * Get buffers for the N blocks of SFS starting at BLOCK into BUFS,
+ * held and busy, in block order (so two threads doing this at once
+ * can't deadlock). If WAIT is false, stop short at the first buffer
+ * after the first that someone else has busy, or that there's no
+ * free buffer for. The number gotten goes in *GOT.
+ *
+ * If WAIT is true and the cache runs out part way, let go of the
+ * buffers we have and wait until there are enough free to start
+ * again, so nobody sits on part of a run waiting for the rest.
+ */
+static
+int
+sfs_buf_dogetrun(struct sfs_fs *sfs, daddr_t block, unsigned n, bool wait,
+		 struct sfs_buf **bufs, unsigned *got)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(n > 0 && n <= SFS_MAXCLUSTER);
+
+ again:
+	for (i=0; i<n; i++) {
+		result = sfs_buf_doget(sfs, block + i, wait || i == 0, i > 0,
+				       &bufs[i]);
+		if (result == EAGAIN && !wait) {
+			break;
+		}
+		if (result == EAGAIN) {
+			KASSERT(i > 0);
+			while (i-- > 0) {
+				sfs_buf_release(bufs[i]);
+			}
+			spinlock_acquire(&sfs_buflock);
+			while (SFS_BUF_SHORT(n)) {
+				wchan_sleep(sfs_bufwchan, &sfs_buflock);
+			}
+			spinlock_release(&sfs_buflock);
+			goto again;
+		}
+		if (result) {
+			while (i-- > 0) {
+				sfs_buf_release(bufs[i]);
+			}
+			return result;
+		}
+	}
+	*got = i;
+	return 0;
+}
+
+/*
+ * Get buffers for the N blocks of SFS starting at BLOCK into BUFS,
+ * held and busy, with whatever the cache has in them.
+ */
+int
+sfs_buf_getrun(struct sfs_fs *sfs, daddr_t block, unsigned n,
+	       struct sfs_buf **bufs)
+{
+	unsigned got;
+
+	return sfs_buf_dogetrun(sfs, block, n, true, bufs, &got);
+}
+
+/*
+ * Like sfs_buf_getrun, but read in the blocks the cache doesn't
+ * have, with as few disk transfers as possible.
+ */
+int
+sfs_buf_readrun(struct sfs_fs *sfs, daddr_t block, unsigned n,
+		struct sfs_buf **bufs)
+{
+	unsigned i;
+	int result;
+
+	result = sfs_buf_getrun(sfs, block, n, bufs);
+	if (result) {
+		return result;
+	}
+	result = sfs_buf_fillrun(bufs, n);
+	if (result) {
+		for (i=0; i<n; i++) {
+			sfs_buf_release(bufs[i]);
+		}
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Like sfs_buf_get, but read the block in if the cache doesn't have
+ * it.
+ */
+int
+sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_readrun(sfs, block, 1, ret);
+}
+
+/*
+ * Transfer the N blocks of SFS starting at BLOCK straight between the
+ * disk and the physically contiguous memory at PA, leaving the cache
+ * out of it, if the cache has nothing for any of them; otherwise fail
+ * with EAGAIN, and the caller should go through the cache instead.
+ *
+ * The buffers are held busy meanwhile, so that nothing (read-ahead,
+ * in particular) can load the old contents of a block we're writing,
+ * and are left without contents.
+ */
+int
+sfs_buf_rwframe(struct sfs_fs *sfs, daddr_t block, unsigned n, paddr_t pa,
+		enum uio_rw rw)
+{
+	struct sfs_buf *bufs[SFS_MAXCLUSTER];
+	unsigned i;
+	int result;
+
+	result = sfs_buf_getrun(sfs, block, n, bufs);
+	if (result) {
+		return result;
+	}
+	for (i=0; i<n; i++) {
+		if (bufs[i]->b_valid) {
+			break;
+		}
+	}
+	if (i < n) {
+		result = EAGAIN;
+	}
+	else {
+		result = sfs_rwframe(sfs, block, n, pa, rw);
+	}
+	for (i=0; i<n; i++) {
+		sfs_buf_release(bufs[i]);
+	}
+	return result;
+}
+
+/*
+ * Get at the contents of a buffer.
+ */
+void *
+sfs_buf_data(struct sfs_buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+/*
+ * Note that a buffer has been changed and needs to be written back,
+ * on behalf of file INO (0 for volume metadata like the freemap).
+ * The whole block is taken to be valid, so a buffer that came from
+ * sfs_buf_get without being valid must have been completely filled
+ * in.
+ */
+void
+sfs_buf_markdirty(struct sfs_buf *b, uint32_t ino)
+{
+	struct timespec now;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_fs != NULL);
+
+	gettime(&now);
+
+	spinlock_acquire(&sfs_buflock);
+	b->b_valid = true;
+	b->b_ino = ino;
+	if (!b->b_dirty) {
+		b->b_dirty = true;
+		b->b_dirtytime = now.tv_sec;
+		sfs_buf_dirty_add(b);
+		sfs_ndirty++;
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Mark a buffer's contents as not matching the block, because the
+ * caller got partway through changing them and gave up. If it was
+ * already dirty we can't throw it away, as that would lose earlier
+ * changes; keep the partial update, as a short write would.
+ */
+void
+sfs_buf_invalidate(struct sfs_buf *b)
+{
+	KASSERT(b->b_busy);
+
+	spinlock_acquire(&sfs_buflock);
+	if (!b->b_dirty) {
+		b->b_valid = false;
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Let go of a buffer.
+ */
+void
+sfs_buf_release(struct sfs_buf *b)
+{
+	spinlock_acquire(&sfs_buflock);
+	sfs_buf_unhold(b);
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Ask for BLOCK of SFS to be read into the cache in the background.
+ * This is only a hint: if the block is already cached or the queue
+ * is full, nothing happens.
+ */
+void
+sfs_buf_readahead(struct sfs_fs *sfs, daddr_t block)
+{
+	unsigned slot;
+
+	spinlock_acquire(&sfs_buflock);
+	if (sfs_racount < SFS_RA_QUEUESIZE &&
+	    sfs_buf_hash_find(sfs, block) == NULL) {
+		slot = (sfs_rahead + sfs_racount) % SFS_RA_QUEUESIZE;
+		sfs_raqueue[slot].ra_fs = sfs;
+		sfs_raqueue[slot].ra_block = block;
+		sfs_racount++;
+		wchan_wakeone(sfs_rawchan, &sfs_buflock);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Drop any read-ahead queued for SFS and wait for the read-ahead
+ * thread to be done with it, so that it won't touch the device again.
+ * Reads already started in the background aren't tracked by volume,
+ * so wait for all of them.
+ */
+void
+sfs_buf_cancelreadahead(struct sfs_fs *sfs)
+{
+	unsigned i, from, to, n;
+
+	if (sfs_rawchan == NULL) {
+		/* never set up, so nothing to do */
+		return;
+	}
+
+	spinlock_acquire(&sfs_buflock);
+	n = sfs_racount;
+	to = sfs_rahead;
+	for (i=0; i<n; i++) {
+		from = (sfs_rahead + i) % SFS_RA_QUEUESIZE;
+		if (sfs_raqueue[from].ra_fs == sfs) {
+			sfs_racount--;
+			continue;
+		}
+		sfs_raqueue[to] = sfs_raqueue[from];
+		to = (to + 1) % SFS_RA_QUEUESIZE;
+	}
+	while (sfs_racurrent == sfs || sfs_nreading > 0) {
+		wchan_sleep(sfs_bufwchan, &sfs_buflock);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+/*
+ * Write back everything file INO of SFS has dirty, for fsync.
+ */
+int
+sfs_buf_flushfile(struct sfs_fs *sfs, uint32_t ino)
+{
+	return sfs_buf_flushsome(sfs, false, ino);
+}
+
+/*
+ * Write back everything SFS has dirty, for sync and unmount.
+ */
+int
+sfs_buf_flushall(struct sfs_fs *sfs)
+{
+	return sfs_buf_flushsome(sfs, true, 0);
+}
+
+/*
+ * Forget all the buffers for a volume, which is being unmounted (or
+ * failed to mount). All must be clean; the syncer may still be
+ * letting go of some, so wait for it.
+ */
+void
+sfs_buf_dropall(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b, *next;
+	unsigned i;
+
+	if (sfs_bufwchan == NULL) {
+		/* never set up, so nothing to do */
+		return;
+	}
+
+	sfs_buf_cancelreadahead(sfs);
+
+	spinlock_acquire(&sfs_buflock);
+ again:
+	for (i=0; i<SFS_BUF_HASHSIZE; i++) {
+		for (b = sfs_bufhash[i]; b != NULL; b = next) {
+			next = b->b_hashnext;
+			if (b->b_fs != sfs) {
+				continue;
+			}
+			KASSERT(!b->b_dirty);
+			if (b->b_refcount > 0) {
+				wchan_sleep(sfs_bufwchan, &sfs_buflock);
+				goto again;
+			}
+			sfs_buf_hash_remove(b);
+			sfs_buf_lru_remove(b);
+			b->b_fs = NULL;
+			b->b_valid = false;
+			sfs_buf_lru_add(b, false);
+		}
+	}
+	spinlock_release(&sfs_buflock);
+}
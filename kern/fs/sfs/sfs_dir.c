@@ -96,22 +96,56 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 }
 
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * Hash a name for the directory index. See <kern/sfs.h>.
+ */
+static
+uint32_t
+sfs_dir_hash(const char *name)
+{
+	uint32_t hash = SFS_DIRHASH_BASIS;
+
+	for (; *name != 0; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= SFS_DIRHASH_PRIME;
+	}
+	return hash;
+}
+
+/*
+ * Return the number of hash buckets in an indexed directory, or 0 if
+ * the directory should be searched linearly. That includes indexed
+ * directories whose size doesn't match the index, which can happen if
+ * we crashed partway through growing one.
+ */
+static
+unsigned
+sfs_dir_nbuckets(struct sfs_vnode *sv)
+{
+	uint32_t n = sv->sv_i.sfi_dirbuckets;
+
+	if (n == 0 || (n & (n - 1)) != 0 || n > SFS_DIR_MAXBUCKETS) {
+		return 0;
+	}
+	if (sv->sv_i.sfi_size != n * SFS_BLOCKSIZE) {
+		return 0;
+	}
+	return n;
+}
+
+/*
+ * Search slots FIRST through LAST-1 of a directory for a name.
  */
+static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
-		uint32_t *ino, int *slot, int *emptyslot)
+sfs_dir_scan(struct sfs_vnode *sv, const char *name, int first, int last,
+	     uint32_t *ino, int *slot, int *emptyslot)
 {
 	struct sfs_direntry tsd;
-	int found, nentries, i, result;
-
-	nentries = sfs_dir_nentries(sv);
+	int found, i, result;
 
 	/* For each slot... */
 	found = 0;
-	for (i=0; i<nentries; i++) {
+	for (i=first; i<last; i++) {
 
 		/* Read the entry from that slot */
 		result = sfs_readdir(sv, i, &tsd);
@@ -146,9 +180,159 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ *
+ * In an indexed directory only the name's home bucket and its buddy
+ * are searched, and only an empty slot in one of those is reported,
+ * preferring the home bucket.
+ */
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		uint32_t *ino, int *slot, int *emptyslot)
+{
+	unsigned nbuckets, home, buddy;
+	int homeempty = -1, buddyempty = -1;
+	int result;
+
+	nbuckets = sfs_dir_nbuckets(sv);
+	if (nbuckets == 0) {
+		return sfs_dir_scan(sv, name, 0, sfs_dir_nentries(sv),
+				    ino, slot, emptyslot);
+	}
+
+	home = sfs_dir_hash(name) & (nbuckets - 1);
+	buddy = (home ^ 1) & (nbuckets - 1);
+
+	result = sfs_dir_scan(sv, name, home * SFS_DIRBUCKET_ENTRIES,
+			      (home + 1) * SFS_DIRBUCKET_ENTRIES,
+			      ino, slot, &homeempty);
+	if (result == ENOENT && buddy != home) {
+		result = sfs_dir_scan(sv, name, buddy * SFS_DIRBUCKET_ENTRIES,
+				      (buddy + 1) * SFS_DIRBUCKET_ENTRIES,
+				      ino, slot, &buddyempty);
+	}
+	if (emptyslot != NULL) {
+		if (homeempty >= 0) {
+			*emptyslot = homeempty;
+		}
+		else if (buddyempty >= 0) {
+			*emptyslot = buddyempty;
+		}
+	}
+	return result;
+}
+
+/*
+ * Turn an empty directory into an indexed directory with one bucket.
+ */
+static
+int
+sfs_dir_index(struct sfs_vnode *sv)
+{
+	struct sfs_direntry sd;
+	unsigned i;
+	int result;
+
+	KASSERT(sv->sv_i.sfi_size == 0);
+
+	bzero(&sd, sizeof(sd));
+	sd.sfd_ino = SFS_NOINO;
+	for (i=0; i<SFS_DIRBUCKET_ENTRIES; i++) {
+		result = sfs_writedir(sv, i, &sd);
+		if (result) {
+			return result;
+		}
+	}
+	sv->sv_i.sfi_dirbuckets = 1;
+	sv->sv_dirty = true;
+	return 0;
+}
+
+/*
+ * Drop the index of a directory, leaving it linear.
+ */
+static
+void
+sfs_dir_unindex(struct sfs_vnode *sv)
+{
+	sv->sv_i.sfi_dirbuckets = 0;
+	sv->sv_dirty = true;
+}
+
+/*
+ * Double the number of buckets in an indexed directory. Going from N
+ * to 2N buckets, each entry in bucket B either stays put or belongs
+ * in bucket B+N, so we split each bucket into the new block at the
+ * end of the directory, keeping entries at the same position within
+ * the bucket. (This holds for entries that overflowed into the buddy
+ * bucket too: the buddy of the new home is B+N's partner just as it
+ * was B's.)
+ *
+ * Each entry is copied before its old slot is cleared, so a crash
+ * can leave a duplicate (which sfsck merges) but never loses a name.
+ * Until the inode is updated the size won't match sfi_dirbuckets, so
+ * the directory reads as linear.
+ */
+static
+int
+sfs_dir_grow(struct sfs_vnode *sv)
+{
+	struct sfs_direntry sd, empty;
+	unsigned nbuckets, bucket, i;
+	int oldslot, newslot;
+	int result;
+
+	nbuckets = sfs_dir_nbuckets(sv);
+	KASSERT(nbuckets > 0 && nbuckets < SFS_DIR_MAXBUCKETS);
+
+	bzero(&empty, sizeof(empty));
+	empty.sfd_ino = SFS_NOINO;
+
+	for (bucket=0; bucket<nbuckets; bucket++) {
+		for (i=0; i<SFS_DIRBUCKET_ENTRIES; i++) {
+			oldslot = bucket * SFS_DIRBUCKET_ENTRIES + i;
+			newslot = oldslot + nbuckets * SFS_DIRBUCKET_ENTRIES;
+
+			result = sfs_readdir(sv, oldslot, &sd);
+			if (result) {
+				return result;
+			}
+			sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+			if (sd.sfd_ino == SFS_NOINO ||
+			    (sfs_dir_hash(sd.sfd_name) & nbuckets) == 0) {
+				/* Stays in the lower half */
+				result = sfs_writedir(sv, newslot, &empty);
+				if (result) {
+					return result;
+				}
+				continue;
+			}
+
+			result = sfs_writedir(sv, newslot, &sd);
+			if (result) {
+				return result;
+			}
+			result = sfs_writedir(sv, oldslot, &empty);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	sv->sv_i.sfi_dirbuckets = nbuckets * 2;
+	sv->sv_dirty = true;
+	return 0;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
+ *
+ * Note that adding a name to an indexed directory can move other
+ * entries to different slots.
  */
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
@@ -157,6 +341,22 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	int result;
 	struct sfs_direntry sd;
 
+	if (strlen(name)+1 > sizeof(sd.sfd_name)) {
+		return ENAMETOOLONG;
+	}
+
+	if (sv->sv_i.sfi_size == 0 && sv->sv_i.sfi_dirbuckets == 0) {
+		/* Empty directories (e.g. from older mksfs) get indexed. */
+		result = sfs_dir_index(sv);
+		if (result) {
+			return result;
+		}
+	}
+	else if (sv->sv_i.sfi_dirbuckets != 0 && sfs_dir_nbuckets(sv) == 0) {
+		/* Index doesn't match the directory; stop using it. */
+		sfs_dir_unindex(sv);
+	}
+
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
 	if (result!=0 && result!=ENOENT) {
@@ -166,8 +366,26 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return EEXIST;
 	}
 
-	if (strlen(name)+1 > sizeof(sd.sfd_name)) {
-		return ENAMETOOLONG;
+	/*
+	 * In an indexed directory the name must go in its home bucket
+	 * or that bucket's buddy. If both are full, grow the directory
+	 * until they aren't; if it can't grow any more, drop the index
+	 * and fall back to linear.
+	 */
+	while (emptyslot < 0 && sfs_dir_nbuckets(sv) > 0) {
+		if (sfs_dir_nbuckets(sv) >= SFS_DIR_MAXBUCKETS) {
+			sfs_dir_unindex(sv);
+			break;
+		}
+		result = sfs_dir_grow(sv);
+		if (result) {
+			return result;
+		}
+		result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
+		if (result!=ENOENT) {
+			KASSERT(result!=0);
+			return result;
+		}
 	}
 
 	/* If we didn't get an empty slot, add the entry at the end. */
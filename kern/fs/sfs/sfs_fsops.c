@@ -45,6 +45,9 @@
 #include "sfsprivate.h"
 
 
+/* Mounted volumes, for sfs_printstats; protected by the vfs biglock */
+static struct sfs_fs *sfs_mounted;
+
 /* Shortcuts for the size macros in kern/sfs.h */
 #define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
 #define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
@@ -118,6 +121,9 @@ sfs_sync_vnodes(struct sfs_fs *sfs)
 	num = vnodearray_num(sfs->sfs_vnodes);
 	for (i=0; i<num; i++) {
 		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
+
+		/* Reservations aren't to go to disk with the freemap */
+		sfs_bunreserve(v->vn_data);
 		VOP_FSYNC(v);
 	}
 	return 0;
@@ -229,6 +235,13 @@ sfs_sync(struct fs *fs)
 		return result;
 	}
 
+	/* Now put everything that's in the buffer cache on disk. */
+	result = sfs_buf_flushall(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	vfs_biglock_release();
 	return 0;
 }
@@ -259,10 +272,12 @@ static
 void
 sfs_fs_destroy(struct sfs_fs *sfs)
 {
+	sfs_buf_dropall(sfs);
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
 	vnodearray_destroy(sfs->sfs_vnodes);
+	kfree(sfs->sfs_vnhash);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,6 +292,8 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	struct sfs_fs **pp;
+	int result;
 
 	vfs_biglock_acquire();
 
@@ -290,6 +307,22 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* But vnodes reclaimed since then may have left dirty buffers. */
+	result = sfs_buf_flushall(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	/* Make sure nothing is still reading ahead from the device */
+	sfs_buf_cancelreadahead(sfs);
+
+	/* Take it off the list of mounted volumes */
+	for (pp = &sfs_mounted; *pp != sfs; pp = &(*pp)->sfs_mountnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = sfs->sfs_mountnext;
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -355,13 +388,28 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnhashsize = SFS_VNHASH_INITSIZE;
+	sfs->sfs_vnhash = kmalloc(sfs->sfs_vnhashsize *
+				  sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnhash == NULL) {
+		goto cleanup_vnodes;
+	}
+	bzero(sfs->sfs_vnhash,
+	      sfs->sfs_vnhashsize * sizeof(struct sfs_vnode *));
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_peakvnodes = 0;
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
 
+	/* not on the mounted list until the mount succeeds */
+	sfs->sfs_mountnext = NULL;
+
 	return sfs;
 
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -408,6 +456,13 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENXIO;
 	}
 
+	/* Set up the buffer cache, if this is the first mount */
+	result = sfs_buf_bootstrap();
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
 		vfs_biglock_release();
@@ -464,6 +519,10 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return result;
 	}
 
+	/* Remember it for sfs_printstats */
+	sfs->sfs_mountnext = sfs_mounted;
+	sfs_mounted = sfs;
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
@@ -479,3 +538,24 @@ sfs_mount(const char *device)
 {
 	return vfs_mount(device, NULL, sfs_domount);
 }
+
+/*
+ * Print vnode table statistics for each mounted volume.
+ */
+void
+sfs_printstats(void)
+{
+	struct sfs_fs *sfs;
+
+	vfs_biglock_acquire();
+	if (sfs_mounted == NULL) {
+		kprintf("No sfs volumes mounted\n");
+	}
+	for (sfs = sfs_mounted; sfs != NULL; sfs = sfs->sfs_mountnext) {
+		kprintf("%s: %u vnodes loaded, at most %u at once, "
+			"%u hash buckets\n", sfs->sfs_sb.sb_volname,
+			sfs->sfs_nvnodes, sfs->sfs_peakvnodes,
+			sfs->sfs_vnhashsize);
+	}
+	vfs_biglock_release();
+}
\ No newline at end of file
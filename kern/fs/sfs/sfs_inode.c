@@ -37,8 +37,137 @@
 #include <lib.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <kmemcache.h>
 #include "sfsprivate.h"
 
+/*
+ * In-memory vnodes come and go with every open and close, so they
+ * come from an object cache.
+ */
+static struct kmem_cache sfs_vnode_cache =
+	KMEM_CACHE_INITIALIZER("sfs_vnode", sizeof(struct sfs_vnode),
+			       NULL, NULL);
+
+/*
+ * Loaded vnodes are kept in sfs_vnodes, for walking all of them, and
+ * in a hash table on inode number, for finding one. Each vnode
+ * remembers its slot in sfs_vnodes so it can be removed without a
+ * search. The hash table doubles when the chains get long.
+ */
+
+static
+unsigned
+sfs_vnhash_bucket(struct sfs_fs *sfs, uint32_t ino)
+{
+	return ino & (sfs->sfs_vnhashsize - 1);
+}
+
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newhash, **oldhash, *sv;
+	unsigned newsize, oldsize, i, b;
+
+	oldsize = sfs->sfs_vnhashsize;
+	newsize = oldsize * 2;
+	newhash = kmalloc(newsize * sizeof(struct sfs_vnode *));
+	if (newhash == NULL) {
+		/* Longer chains, but nothing's wrong; try again later. */
+		return;
+	}
+	bzero(newhash, newsize * sizeof(struct sfs_vnode *));
+
+	oldhash = sfs->sfs_vnhash;
+	sfs->sfs_vnhash = newhash;
+	sfs->sfs_vnhashsize = newsize;
+
+	for (i=0; i<oldsize; i++) {
+		while ((sv = oldhash[i]) != NULL) {
+			oldhash[i] = sv->sv_hashnext;
+			b = sfs_vnhash_bucket(sfs, sv->sv_ino);
+			sv->sv_hashnext = newhash[b];
+			newhash[b] = sv;
+		}
+	}
+	kfree(oldhash);
+}
+
+static
+struct sfs_vnode *
+sfs_vnodetable_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	sv = sfs->sfs_vnhash[sfs_vnhash_bucket(sfs, ino)];
+	for (; sv != NULL; sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+int
+sfs_vnodetable_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned b;
+	int result;
+
+	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn,
+				&sv->sv_index);
+	if (result) {
+		return result;
+	}
+
+	b = sfs_vnhash_bucket(sfs, sv->sv_ino);
+	sv->sv_hashnext = sfs->sfs_vnhash[b];
+	sfs->sfs_vnhash[b] = sv;
+
+	sfs->sfs_nvnodes++;
+	if (sfs->sfs_nvnodes > sfs->sfs_peakvnodes) {
+		sfs->sfs_peakvnodes = sfs->sfs_nvnodes;
+	}
+	if (sfs->sfs_nvnodes > 2 * sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+	}
+	return 0;
+}
+
+static
+void
+sfs_vnodetable_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+	struct vnode *last;
+	unsigned num;
+
+	pp = &sfs->sfs_vnhash[sfs_vnhash_bucket(sfs, sv->sv_ino)];
+	while (*pp != sv) {
+		if (*pp == NULL) {
+			panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+			      sfs->sfs_sb.sb_volname, sv->sv_ino);
+		}
+		pp = &(*pp)->sv_hashnext;
+	}
+	*pp = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+
+	/* Move the last vnode in the array into our slot. */
+	num = vnodearray_num(sfs->sfs_vnodes);
+	KASSERT(sv->sv_index < num);
+	KASSERT(vnodearray_get(sfs->sfs_vnodes, sv->sv_index) ==
+		&sv->sv_absvn);
+	last = vnodearray_get(sfs->sfs_vnodes, num - 1);
+	vnodearray_set(sfs->sfs_vnodes, sv->sv_index, last);
+	((struct sfs_vnode *)last->vn_data)->sv_index = sv->sv_index;
+	/* shrinking can't fail */
+	vnodearray_setsize(sfs->sfs_vnodes, num - 1);
+
+	KASSERT(sfs->sfs_nvnodes > 0);
+	sfs->sfs_nvnodes--;
+}
 
 /*
  * Write an on-disk inode structure back out to disk.
@@ -70,7 +199,6 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
 	vfs_biglock_acquire();
@@ -93,6 +221,9 @@ sfs_reclaim(struct vnode *v)
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/* Give back any blocks we were saving for it */
+	sfs_bunreserve(sv);
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
@@ -115,28 +246,14 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnodetable_remove(sfs, sv);
 
 	vnode_cleanup(&sv->sv_absvn);
 
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(&sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -150,41 +267,30 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
+	sv = sfs_vnodetable_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(&sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -198,7 +304,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -235,18 +341,22 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_ranext = 0;
+	sv->sv_raend = 0;
+	sv->sv_resblock = 0;
+	sv->sv_rescount = 0;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
+	result = sfs_vnodetable_add(sfs, sv);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -256,10 +366,12 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 }
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object and hand back its vnode. NEARINO is
+ * the directory it's going in; we try to put it close by.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, int type, uint32_t nearino,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -269,7 +381,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, nearino, &ino);
 	if (result) {
 		return result;
 	}
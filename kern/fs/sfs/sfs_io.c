@@ -36,8 +36,11 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <copyinout.h>
+#include <vm.h>
 #include <vfs.h>
 #include <device.h>
+#include <diskstat.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -49,92 +52,263 @@
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
- * except sfs_device.
+ * except sfs_device. (The buffer cache only uses the
+ * pointer itself.)
  */
 
 /*
- * Read or write a block, retrying I/O errors.
+ * Deal with the result of a disk transfer starting at BLOCK, which
+ * has been tried *TRIES times before. Returns true if it should be
+ * tried again.
  */
 static
-int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+bool
+sfs_ioretry(struct sfs_fs *sfs, daddr_t block, int result, int *tries)
 {
-	int result;
-	int tries=0;
-
-	KASSERT(vfs_biglock_do_i_hold());
-
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
-
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
 	if (result == EINVAL) {
 		/*
 		 * This means the sector we requested was out of range,
 		 * or the seek address we gave wasn't sector-aligned,
 		 * or a couple of other things that are our fault.
 		 */
-		panic("sfs: %s: DEVOP_IO returned EINVAL\n",
+		panic("sfs: %s: device I/O returned EINVAL\n",
 		      sfs->sfs_sb.sb_volname);
 	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: %s: block %llu I/O error, retrying\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
-		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
-		}
-		else {
-			kprintf("sfs: %s: block %llu I/O error, giving up "
-				"after %d retries\n",
-				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+	if (result != EIO) {
+		return false;
+	}
+	if (*tries == 0) {
+		kprintf("sfs: %s: block %u I/O error, retrying\n",
+			sfs->sfs_sb.sb_volname, block);
+	}
+	else if (*tries >= 10) {
+		kprintf("sfs: %s: block %u I/O error, giving up "
+			"after %d retries\n",
+			sfs->sfs_sb.sb_volname, block, *tries);
+		return false;
+	}
+	(*tries)++;
+	if (sfs->sfs_device->d_stats != NULL) {
+		diskstats_retry(sfs->sfs_device->d_stats);
+	}
+	return true;
+}
+
+/*
+ * Read or write a block, or a run of up to SFS_MAXCLUSTER consecutive
+ * blocks, to or from the device, retrying I/O errors. This bypasses
+ * the buffer cache; it's what the buffer cache uses.
+ *
+ * This doesn't need the big lock (the syncer and read-ahead threads
+ * call it without): it only uses the device and the volume name,
+ * which don't change while the volume is mounted.
+ */
+int
+sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+{
+	struct iovec iovsave[SFS_MAXCLUSTER];
+	struct uio uiosave;
+	daddr_t block;
+	int result;
+	int tries=0;
+
+	KASSERT(sfs->sfs_device != NULL);
+	KASSERT(uio->uio_iovcnt <= SFS_MAXCLUSTER);
+
+	/* The device eats the uio as it goes; keep a copy for retries. */
+	uiosave = *uio;
+	memcpy(iovsave, uio->uio_iov, uio->uio_iovcnt * sizeof(iovsave[0]));
+	block = uio->uio_offset / SFS_BLOCKSIZE;
+
+	DEBUG(DB_SFS, "sfs: %s %u\n",
+	      uio->uio_rw == UIO_READ ? "read" : "write", block);
+
+	while (1) {
+		result = DEVOP_IO(sfs->sfs_device, uio);
+		if (!sfs_ioretry(sfs, block, result, &tries)) {
+			break;
 		}
+		*uio = uiosave;
+		memcpy(uio->uio_iov, iovsave,
+		       uio->uio_iovcnt * sizeof(iovsave[0]));
 	}
 	return result;
 }
 
 /*
- * Read a block.
+ * Can the device move data straight to and from physical memory?
+ */
+bool
+sfs_canframeio(struct sfs_fs *sfs)
+{
+	return sfs->sfs_device->d_ops->devop_frameio != NULL;
+}
+
+/*
+ * Like sfs_rwblock, but for the N blocks starting at BLOCK and the
+ * physically contiguous memory at PA, using the device's frame I/O.
+ * The data doesn't pass through any kernel buffer on the way.
+ */
+int
+sfs_rwframe(struct sfs_fs *sfs, daddr_t block, unsigned n, paddr_t pa,
+	    enum uio_rw rw)
+{
+	int result;
+	int tries=0;
+
+	KASSERT(sfs_canframeio(sfs));
+	KASSERT(n > 0 && n <= SFS_MAXCLUSTER);
+
+	DEBUG(DB_SFS, "sfs: %s %u-%u direct\n",
+	      rw == UIO_READ ? "read" : "write", block, block + n - 1);
+
+	do {
+		result = DEVOP_FRAMEIO(sfs->sfs_device, pa, n * SFS_BLOCKSIZE,
+				       (off_t)block * SFS_BLOCKSIZE, rw);
+	} while (sfs_ioretry(sfs, block, result, &tries));
+	return result;
+}
+
+/*
+ * Can the device do transfers in the background?
+ */
+bool
+sfs_canasyncio(struct sfs_fs *sfs)
+{
+	return sfs->sfs_device->d_ops->devop_submit != NULL;
+}
+
+/*
+ * Start moving BLOCK to or from the kernel buffer DATA in the
+ * background, using REQ, and return at once. DONE is called with REQ
+ * and the result when it's finished, in interrupt context (see
+ * <device.h>), or right away if the device won't take it. Errors are
+ * neither retried nor reported; that's up to DONE.
+ */
+void
+sfs_startio(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw,
+	    struct devreq *req, void (*done)(struct devreq *, int), void *arg)
+{
+	struct device *dev = sfs->sfs_device;
+	unsigned per;
+	int result;
+
+	KASSERT(sfs_canasyncio(sfs));
+	KASSERT(SFS_BLOCKSIZE % dev->d_blocksize == 0);
+
+	DEBUG(DB_SFS, "sfs: %s %u async\n",
+	      rw == UIO_READ ? "read" : "write", block);
+
+	per = SFS_BLOCKSIZE / dev->d_blocksize;
+	req->dr_rw = rw;
+	req->dr_block = block * per;
+	req->dr_nblocks = per;
+	req->dr_data = data;
+	req->dr_done = done;
+	req->dr_arg = arg;
+
+	result = DEVOP_SUBMIT(dev, req);
+	if (result == EINVAL) {
+		/* As in sfs_ioretry, this is our fault. */
+		panic("sfs: %s: device I/O returned EINVAL\n",
+		      sfs->sfs_sb.sb_volname);
+	}
+	if (result) {
+		done(req, result);
+	}
+}
+
+/*
+ * Read a block, through the buffer cache.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_buf_read(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, sfs_buf_data(buf), len);
+	sfs_buf_release(buf);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Write a block, through the buffer cache. It goes to disk later.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	/* No need to read it first; we're replacing all of it. */
+	result = sfs_buf_get(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(sfs_buf_data(buf), data, len);
+	sfs_buf_markdirty(buf, 0);
+	sfs_buf_release(buf);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
 
+/*
+ * Fault in the user memory that the next LEN bytes of UIO go to or
+ * come from, before taking hold of any buffers. Otherwise uiomove
+ * could fault with buffers held busy, and if the fault reads the page
+ * in from a file on this volume (a program reading its own executable
+ * into a page not yet loaded, say), it would wait forever for a
+ * buffer we have. Once a page is in, faulting on it again only goes
+ * to swap. Each page is touched the way uiomove will use it: read
+ * from, or (by writing back what's there) written to.
+ */
+static
+int
+sfs_uiotouch(struct uio *uio, size_t len)
+{
+	struct iovec *iov;
+	vaddr_t va, end;
+	unsigned i;
+	size_t n;
+	char ch;
+	int result;
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return 0;
+	}
+
+	for (i=0; i<uio->uio_iovcnt && len > 0; i++) {
+		iov = &uio->uio_iov[i];
+		n = iov->iov_len < len ? iov->iov_len : len;
+		va = (vaddr_t)iov->iov_ubase;
+		end = va + n;
+		while (va < end) {
+			result = copyin((const_userptr_t)va, &ch, 1);
+			if (result == 0 && uio->uio_rw == UIO_READ) {
+				result = copyout(&ch, (userptr_t)va, 1);
+			}
+			if (result) {
+				return result;
+			}
+			va = (va & PAGE_FRAME) + PAGE_SIZE;
+		}
+		len -= n;
+	}
+	return 0;
+}
+
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
  * need to read in the original block first, even if we're writing, so
@@ -150,16 +324,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *iobuf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +335,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,58 +347,108 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		return uiomovezeros(len, uio);
 	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+
+	result = sfs_uiotouch(uio, len);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Get the block into the buffer cache.
+	 */
+	result = sfs_buf_read(sfs, diskblock, &iobuf);
+	if (result) {
+		return result;
 	}
 
 	/*
 	 * Now perform the requested operation into/out of the buffer.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = uiomove((char *)sfs_buf_data(iobuf) + skipstart, len, uio);
 	if (result) {
+		if (uio->uio_rw == UIO_WRITE) {
+			/* We may have scribbled on part of it. */
+			sfs_buf_invalidate(iobuf);
+		}
+		sfs_buf_release(iobuf);
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, the block needs writing back.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		sfs_buf_markdirty(iobuf, sv->sv_ino);
 	}
 
+	sfs_buf_release(iobuf);
 	return 0;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Check whether the next *N blocks' worth of UIO can be transferred
+ * by the device straight to or from memory: they must be in kernel
+ * memory with a fixed physical address, like a page frame the VM
+ * system is filling in or writing out, and the device must be able
+ * to do it. If so, return the physical address in *PA, cutting *N
+ * down to the whole blocks that fit in the current iovec.
+ */
+static
+bool
+sfs_uioframe(struct sfs_fs *sfs, struct uio *uio, uint32_t *n, paddr_t *pa)
+{
+	struct iovec *iov;
+	vaddr_t va;
+
+	if (uio->uio_segflg != UIO_SYSSPACE || !sfs_canframeio(sfs)) {
+		return false;
+	}
+
+	/* Step over any empty iovecs, as uiomove would. */
+	while (uio->uio_iov->iov_len == 0) {
+		KASSERT(uio->uio_iovcnt > 1);
+		uio->uio_iov++;
+		uio->uio_iovcnt--;
+	}
+	iov = uio->uio_iov;
+
+	va = (vaddr_t)iov->iov_kbase;
+	if (!KVADDR_ISDIRECT(va) || iov->iov_len < SFS_BLOCKSIZE) {
+		return false;
+	}
+	if (*n > iov->iov_len / SFS_BLOCKSIZE) {
+		*n = iov->iov_len / SFS_BLOCKSIZE;
+	}
+	*pa = KVADDR_TO_PADDR(va);
+	return true;
+}
+
+/*
+ * Do I/O (either read or write) of whole blocks: as many of the next
+ * NBLOCKS as lie in consecutive blocks on disk, up to SFS_MAXCLUSTER,
+ * so that whatever has to go to disk goes in one transfer. Reports
+ * how many blocks were done in *DONE.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, uint32_t nblocks,
+	    uint32_t *done)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
-	uint32_t fileblock;
+	struct sfs_buf *iobufs[SFS_MAXCLUSTER];
+	struct iovec *iov;
+	daddr_t diskblock, nextblock;
+	uint32_t fileblock, n, nframe, i;
+	paddr_t pa;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+
+	*done = 0;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -254,37 +467,146 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		result = uiomovezeros(SFS_BLOCKSIZE, uio);
+		if (result == 0) {
+			*done = 1;
+		}
+		return result;
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * See how far the run goes on disk. If looking up (or
+	 * allocating) the next block fails, just stop there; we'll
+	 * get the error again next time around if it's real.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	if (nblocks > SFS_MAXCLUSTER) {
+		nblocks = SFS_MAXCLUSTER;
+	}
+	for (n = 1; n < nblocks; n++) {
+		result = sfs_bmap(sv, fileblock + n, doalloc, &nextblock);
+		if (result || nextblock != diskblock + n) {
+			break;
+		}
+	}
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * If the disk can get at the memory directly and the cache
+	 * doesn't have any of the blocks, skip the cache, so the data
+	 * is copied once instead of twice.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
-
-	result = sfs_rwblock(sfs, uio);
+	nframe = n;
+	if (sfs_uioframe(sfs, uio, &nframe, &pa)) {
+		result = sfs_buf_rwframe(sfs, diskblock, nframe, pa,
+					 uio->uio_rw);
+		if (result == 0) {
+			iov = uio->uio_iov;
+			iov->iov_kbase = (char *)iov->iov_kbase +
+				nframe * SFS_BLOCKSIZE;
+			iov->iov_len -= nframe * SFS_BLOCKSIZE;
+			uio->uio_offset += nframe * SFS_BLOCKSIZE;
+			uio->uio_resid -= nframe * SFS_BLOCKSIZE;
+			*done = nframe;
+			return 0;
+		}
+		if (result != EAGAIN) {
+			return result;
+		}
+	}
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
+	 * Go through the buffer cache. If we're writing we're going
+	 * to replace the whole blocks, so don't bother reading them.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	KASSERT(uio->uio_resid >= n * SFS_BLOCKSIZE);
+	result = sfs_uiotouch(uio, n * SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_buf_readrun(sfs, diskblock, n, iobufs);
+	}
+	else {
+		result = sfs_buf_getrun(sfs, diskblock, n, iobufs);
+	}
+	if (result) {
+		return result;
+	}
 
+	for (i=0; i<n; i++) {
+		result = uiomove(sfs_buf_data(iobufs[i]), SFS_BLOCKSIZE, uio);
+		if (result) {
+			if (uio->uio_rw == UIO_WRITE) {
+				/* We may have scribbled on part of it. */
+				sfs_buf_invalidate(iobufs[i]);
+			}
+			break;
+		}
+		if (uio->uio_rw == UIO_WRITE) {
+			sfs_buf_markdirty(iobufs[i], sv->sv_ino);
+		}
+	}
+	*done = i;
+
+	for (i=0; i<n; i++) {
+		sfs_buf_release(iobufs[i]);
+	}
 	return result;
 }
 
+/*
+ * Read-ahead.
+ *
+ * A read that starts where the last one left off (or in the block
+ * where it left off, for reads that aren't block-sized) is taken to
+ * be part of a sequential scan, and the next sfs_readahead_window
+ * blocks of the file are queued to be read into the buffer cache in
+ * the background. To avoid doing this on every read, we only top it
+ * up when less than half a window is still outstanding.
+ */
+unsigned sfs_readahead_window = SFS_READAHEAD_WINDOW;
+
+static
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t firstblock, uint32_t lastblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t window, fileblocks, start, end, fb;
+	daddr_t diskblock;
+
+	if (firstblock != sv->sv_ranext && firstblock + 1 != sv->sv_ranext) {
+		/* Not sequential; start over from here. */
+		sv->sv_ranext = lastblock + 1;
+		sv->sv_raend = 0;
+		return;
+	}
+	sv->sv_ranext = lastblock + 1;
+
+	window = sfs_readahead_window;
+	if (window == 0 || sv->sv_raend > sv->sv_ranext + window / 2) {
+		return;
+	}
+
+	start = sv->sv_raend > sv->sv_ranext ? sv->sv_raend : sv->sv_ranext;
+	end = sv->sv_ranext + window;
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	if (end > fileblocks) {
+		end = fileblocks;
+	}
+
+	for (fb = start; fb < end; fb++) {
+		if (sfs_bmap(sv, fb, false, &diskblock)) {
+			/* Never mind, it's only read-ahead. */
+			break;
+		}
+		if (diskblock != 0) {
+			sfs_buf_readahead(sfs, diskblock);
+		}
+	}
+	if (fb > sv->sv_raend) {
+		sv->sv_raend = fb;
+	}
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -292,11 +614,13 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, done;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origoffset;
 
 	origresid = uio->uio_resid;
+	origoffset = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -352,11 +676,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (nblocks > 0) {
+		result = sfs_blockio(sv, uio, nblocks, &done);
 		if (result) {
 			goto out;
 		}
+		nblocks -= done;
 	}
 
 	/*
@@ -373,6 +698,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 
  out:
 
+	/* If reading sequentially, get the next blocks coming */
+	if (uio->uio_resid != origresid && uio->uio_rw == UIO_READ) {
+		sfs_readahead(sv, origoffset / SFS_BLOCKSIZE,
+			      (uio->uio_offset - 1) / SFS_BLOCKSIZE);
+	}
+
 	/* If writing and we did anything, adjust file length */
 	if (uio->uio_resid != origresid &&
 	    uio->uio_rw == UIO_WRITE &&
@@ -407,6 +738,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *metaiobuf;
+	char *data_block;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +747,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -447,25 +768,24 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	}
 
 	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	result = sfs_buf_read(sfs, diskblock, &metaiobuf);
 	if (result) {
 		return result;
 	}
+	data_block = sfs_buf_data(metaiobuf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, data_block + blockoffset, len);
+		sfs_buf_release(metaiobuf);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
+		memcpy(data_block + blockoffset, data, len);
 
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		/* The block needs writing back */
+		sfs_buf_markdirty(metaiobuf, sv->sv_ino);
+		sfs_buf_release(metaiobuf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -222,10 +222,15 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	vfs_biglock_acquire();
 	result = sfs_sync_inode(sv);
+	if (result == 0) {
+		/* Write back this file's blocks, and only this file's. */
+		result = sfs_buf_flushfile(sfs, sv->sv_ino);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -317,7 +322,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, SFS_TYPE_FILE, sv->sv_ino, &newguy);
 	if (result) {
 		vfs_biglock_release();
 		return result;
@@ -470,6 +475,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
 
+	/*
+	 * Linking can move entries around in an indexed directory, so
+	 * find the old name's slot again before unlinking it.
+	 */
+	result = sfs_dir_findname(sv, n1, NULL, &slot1, NULL);
+	if (result) {
+		goto puke_harder;
+	}
+
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
 	if (result) {
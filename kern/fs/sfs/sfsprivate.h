@@ -41,12 +41,47 @@ extern const struct vnode_ops sfs_dirops;
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
+/* Most blocks reserved ahead of a file being written (see sfs_balloc.c) */
+#define SFS_PREALLOC 8
+
+/* Most blocks moved in one disk transfer */
+#define SFS_MAXCLUSTER 16
+
+/* Default read-ahead window, in blocks (see sfs_io.c) */
+#define SFS_READAHEAD_WINDOW 16
+
+/* Initial number of vnode hash buckets; a power of 2 (see sfs_inode.c) */
+#define SFS_VNHASH_INITSIZE 64
+
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+int sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock);
+void sfs_bunreserve(struct sfs_vnode *sv);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
+/* Functions in sfs_buf.c */
+struct sfs_buf;
+int sfs_buf_bootstrap(void);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_getrun(struct sfs_fs *sfs, daddr_t block, unsigned n,
+		struct sfs_buf **bufs);
+int sfs_buf_readrun(struct sfs_fs *sfs, daddr_t block, unsigned n,
+		struct sfs_buf **bufs);
+int sfs_buf_rwframe(struct sfs_fs *sfs, daddr_t block, unsigned n,
+		paddr_t pa, enum uio_rw rw);
+void *sfs_buf_data(struct sfs_buf *b);
+void sfs_buf_markdirty(struct sfs_buf *b, uint32_t ino);
+void sfs_buf_invalidate(struct sfs_buf *b);
+void sfs_buf_release(struct sfs_buf *b);
+int sfs_buf_flushfile(struct sfs_fs *sfs, uint32_t ino);
+int sfs_buf_flushall(struct sfs_fs *sfs);
+void sfs_buf_readahead(struct sfs_fs *sfs, daddr_t block);
+void sfs_buf_cancelreadahead(struct sfs_fs *sfs);
+void sfs_buf_dropall(struct sfs_fs *sfs);
+
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
@@ -67,10 +102,20 @@ int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_makeobj(struct sfs_fs *sfs, int type, uint32_t nearino,
+		struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
 /* Functions in sfs_io.c */
+struct devreq;
+int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
+bool sfs_canframeio(struct sfs_fs *sfs);
+int sfs_rwframe(struct sfs_fs *sfs, daddr_t block, unsigned n, paddr_t pa,
+		enum uio_rw rw);
+bool sfs_canasyncio(struct sfs_fs *sfs);
+void sfs_startio(struct sfs_fs *sfs, daddr_t block, void *data,
+		enum uio_rw rw, struct devreq *req,
+		void (*done)(struct devreq *, int), void *arg);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
@@ -39,13 +39,43 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct pagetable;
 
 
+#if !OPT_DUMBVM
+/*
+ * Region - a contiguous range of virtual pages with uniform
+ * permissions, as defined by as_define_region or as_define_stack.
+ * Pages in a region are not backed by anything until they are first
+ * touched; vm_fault then fills them in, reading from rg_vnode if the
+ * page overlaps the file-backed part of the region and zero-filling
+ * the rest.
+ */
+struct region {
+	vaddr_t rg_vbase;		/* first virtual address (page aligned) */
+	size_t rg_npages;		/* length in pages */
+	bool rg_readable;
+	bool rg_writeable;
+	bool rg_executable;
+	struct vnode *rg_vnode;		/* backing file, or NULL (referenced) */
+	vaddr_t rg_filevaddr;		/* where the file contents begin... */
+	off_t rg_fileoffset;		/* ...where they come from... */
+	size_t rg_filesize;		/* ...and how many bytes there are */
+	struct region *rg_next;
+};
+
+/* Size of the user stack region. Pages are only allocated as used. */
+#define VM_STACKPAGES    1024
+#endif
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
  *
- * You write this.
+ * as_lock protects the region list and the page table. It is a sleep
+ * lock, so it must not be taken from interrupt context or with a
+ * spinlock held.
  */
 
 struct addrspace {
@@ -58,7 +88,14 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct lock *as_lock;		/* protects the fields below */
+        struct region *as_regions;	/* list of defined regions */
+        struct pagetable *as_pt;	/* virtual to physical mappings */
+        bool as_loading;		/* inside as_prepare/complete_load */
+        uint32_t as_asid;		/* MMU address space ID; see vm.c */
+        uint32_t as_cpumask;		/* CPUs that have used as_asid */
+        struct addrspace *as_next;	/* list of all address spaces */
+        struct addrspace **as_prevp;
 #endif
 };
 
@@ -87,7 +124,11 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. If V is not NULL, the first FILESIZE bytes of
+ *                the region are the contents of V starting at OFFSET
+ *                and the rest is zero-filled; the region holds a
+ *                reference to V and the VM system may read pages in
+ *                from it at any time, i.e., lazily on first touch.
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -99,6 +140,15 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_findregion - return the region containing VADDR, or NULL.
+ *                The caller must hold as_lock.
+ *
+ *    as_findmapping - return the address space that maps physical
+ *                page PA at VADDR, or NULL. Used by the pageout code
+ *                to find who is left using a page fork shared, once
+ *                the other sharers are gone. Slow: looks through
+ *                every address space.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -113,10 +163,17 @@ int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
                                    int readable,
                                    int writeable,
-                                   int executable);
+                                   int executable,
+                                   struct vnode *v,
+                                   off_t offset,
+                                   size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+struct addrspace *as_findmapping(paddr_t pa, vaddr_t vaddr);
+#endif
 
 
 /*
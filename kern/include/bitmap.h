@@ -38,10 +38,19 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Searches from just past the last bit it handed
+ *                      out, so successive calls don't rescan full space.
+ *     bitmap_alloc_near - same, but take the first cleared bit at or
+ *                      after a given index, wrapping around at the end.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
  *     bitmap_destroy - destroy bitmap.
+ *
+ * Large bitmaps also keep an in-memory summary of which bytes are
+ * full, so searches can skip over full regions quickly. If you write
+ * the raw data from bitmap_getdata, the summary is recomputed on the
+ * next allocation.
  */
 
 
@@ -50,6 +59,8 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_near(struct bitmap *, unsigned goal,
+                                 unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
@@ -38,21 +38,23 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called from each CPU's timer interrupt. Until
+ * clock_start() is called, the timer goes off HZ times a second and
+ * every call is a scheduling tick. After that it's programmed one
+ * interrupt at a time: hardclock runs any timeouts (see <timeout.h>)
+ * that are due, takes a scheduling tick HZ times a second if the CPU
+ * is busy, and sets the timer for whichever of those comes next. An
+ * idle CPU doesn't tick; clock_unidle() starts the ticks again when
+ * it finds something to run.
  */
 
-/* hardclocks per second */
+/* scheduling ticks per second */
 #define HZ  100
 
 void hardclock_bootstrap(void);
+void clock_start(void);
 void hardclock(void);
-
-/*
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
- */
-void timerclock(void);
+void clock_unidle(void);
 
 /*
  * gettime() may be used to fetch the current time of day.
@@ -76,8 +78,11 @@ void timespec_sub(const struct timespec *t1,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocknanosleep() does the same for any length of time, to within
+ * the resolution of the timer.
  */
 void clocksleep(int seconds);
+void clocknanosleep(const struct timespec *duration);
 
 
 #endif /* _CLOCK_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator.
+ *
+ * The coremap has one entry for every physical page of RAM. Pages
+ * are either fixed (the kernel image and anything allocated with
+ * ram_stealmem before the VM system started), free, owned by the
+ * kernel (handed out by alloc_kpages), or owned by a user address
+ * space, in which case the entry records which address space and
+ * which virtual page map it.
+ *
+ * Functions:
+ *     coremap_bootstrap   - take over physical memory from ram.c.
+ *     coremap_startpageout - start the pageout daemon. Call after
+ *                           swap_bootstrap.
+ *     coremap_alloc_kpages - allocate NPAGES physically contiguous
+ *                           kernel pages. Returns 0 if out of memory.
+ *     coremap_alloc_upage - allocate one page for virtual page VADDR
+ *                           of address space AS, zero-filled if ZERO
+ *                           is set. The page comes back pinned.
+ *                           Returns 0 if out of memory.
+ *     coremap_free        - drop a reference to a page (or free a run
+ *                           of kernel pages) given its physical address.
+ *                           For user pages this also drops the caller's
+ *                           pin.
+ *     coremap_pin         - wait until the page mapped by PTE is not
+ *                           busy and pin it. Returns false, without
+ *                           pinning anything, if PTE is not (or is no
+ *                           longer) resident.
+ *     coremap_unpin       - release a pin taken by coremap_pin or
+ *                           coremap_alloc_upage.
+ *     coremap_share       - add a reference to a user page, which is
+ *                           then mapped copy-on-write by more than one
+ *                           address space.
+ *     coremap_claim       - if AS holds the only reference to a user
+ *                           page, record it as the owner at VADDR and
+ *                           return true; otherwise return false and
+ *                           the caller must copy the page. A claimed
+ *                           page is about to be written, so any clean
+ *                           copy in swap is discarded.
+ *     coremap_setclean    - record that a pinned user page has an
+ *                           up-to-date copy in swap slot SLOT, which
+ *                           the page now owns. Every mapping of the
+ *                           page must lack PTE_WRITE.
+ *     coremap_used_bytes  - declared in <vm.h>.
+ *
+ * User pages are reference counted so that fork can share them. A
+ * page with more than one reference has no single owner; cme_as is
+ * NULL until some address space claims it again, or until the clock
+ * finds it down to one reference and looks up who still maps it (see
+ * as_findmapping).
+ *
+ * When memory runs out, pages with a single owner are written to
+ * swap (see <swap.h>) and their page table entries are changed to
+ * point at the swap slot. The clock hand sweeps the coremap, giving
+ * recently referenced pages a second chance.
+ *
+ * Normally this is done ahead of time by the pageout daemon, which
+ * wakes up when the number of free pages falls below a low-water
+ * mark and evicts pages in batches, writing dirty ones to a run of
+ * consecutive swap slots in a single transfer, until the high-water
+ * mark is reached. Only if there are still no free pages does an
+ * allocation evict a page itself. Pages that are clean, i.e. that
+ * were read back in from swap and not written since, keep their
+ * swap slot and can be evicted without writing anything.
+ *
+ * The pageout runs without the owner's address space lock, so the
+ * page table entry of a resident user page may only be read or
+ * changed, and its contents used, by someone holding a pin on the
+ * page (cme_busy), which is exactly what the pageout code takes
+ * before it starts. (The one exception is the clock setting
+ * PTE_NOREF, which it does with the coremap lock held and only on
+ * pages nobody has pinned.)
+ */
+
+#include <pagetable.h>
+
+struct addrspace;
+
+/* Page states. */
+#define CM_FREE     0    /* available */
+#define CM_FIXED    1    /* kernel image or stolen before bootstrap */
+#define CM_KERNEL   2    /* allocated with alloc_kpages */
+#define CM_USER     3    /* mapped by a user address space */
+
+struct coremap_entry {
+	struct addrspace *cme_as;	/* owning address space (CM_USER) */
+	vaddr_t cme_vaddr;		/* virtual page it's mapped at */
+	unsigned cme_state:2;		/* one of the CM_* states */
+	unsigned cme_busy:1;		/* pinned; see coremap_pin */
+	unsigned cme_referenced:1;	/* used since the clock hand passed */
+	unsigned cme_refcount:12;	/* mappings of a CM_USER page */
+	unsigned cme_npages:16;		/* length of a kernel run (first page) */
+	unsigned cme_clean:1;		/* contents match cme_slot */
+	unsigned cme_slot:20;		/* swap copy, if cme_clean */
+};
+
+void coremap_bootstrap(void);
+void coremap_startpageout(void);
+paddr_t coremap_alloc_kpages(unsigned npages);
+paddr_t coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr, bool zero);
+void coremap_free(paddr_t paddr);
+bool coremap_pin(pte_t *pte);
+void coremap_unpin(paddr_t paddr);
+void coremap_share(paddr_t paddr);
+bool coremap_claim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_setclean(paddr_t paddr, unsigned slot);
+
+
+#endif /* _COREMAP_H_ */
@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <timeout.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 extern unsigned num_cpus;
@@ -47,6 +48,8 @@ extern unsigned num_cpus;
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+struct kmalloc_cpucache;
+
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -62,6 +65,7 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct kmalloc_cpucache *c_kmcache; /* kmalloc magazines */
 
 	/*
 	 * Accessed by other cpus.
@@ -71,6 +75,12 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus (to cancel timeouts).
+	 * Protected by its own lock.
+	 */
+	struct timeoutwheel c_timeouts;	/* Pending timeouts */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -156,6 +166,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_mask sends shootdown data to each other CPU whose
+ * number (c_number) is set in a bit mask.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -170,6 +182,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_mask(uint32_t cpumask,
+			  const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -34,8 +34,10 @@
  * Devices.
  */
 
+#include <uio.h>
+#include <kern/time.h>
 
-struct uio;  /* in <uio.h> */
+struct diskstats;  /* in <diskstat.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -49,6 +51,33 @@ struct device {
 	dev_t d_devnumber;	/* serial number for this device */
 
 	void *d_data;		/* device-specific data */
+	struct diskstats *d_stats; /* I/O statistics (disks), or NULL */
+};
+
+/*
+ * A transfer done in the background (see devop_submit): move
+ * DR_NBLOCKS device blocks starting at block DR_BLOCK to or from the
+ * kernel buffer DR_DATA, in direction DR_RW, then call DR_DONE with
+ * the result. DR_DONE runs in interrupt context, possibly with the
+ * driver's locks held, so it must not sleep or submit more requests.
+ * The submitter provides the storage and leaves it alone until
+ * DR_DONE is called.
+ */
+struct devreq {
+	/* Set by the submitter */
+	enum uio_rw dr_rw;		/* read or write */
+	uint32_t dr_block;		/* first block */
+	uint32_t dr_nblocks;		/* number of blocks */
+	void *dr_data;			/* kernel buffer */
+	void (*dr_done)(struct devreq *, int result);
+	void *dr_arg;			/* for the submitter's use */
+
+	/* Private to the driver */
+	uint32_t dr_ndone;		/* blocks done so far */
+	struct timespec dr_queued;	/* when it was submitted */
+	struct devreq *dr_next;		/* queue */
+	struct devreq *dr_mergenext;	/* next request in merged run */
+	struct devreq *dr_mergetail;	/* last request in run (head only) */
 };
 
 /*
@@ -56,11 +85,26 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_frameio - optional; move LEN bytes between the device at
+ *                      offset POS and physically contiguous memory at
+ *                      PA, in direction RW. For block devices that can
+ *                      put data straight into its final destination,
+ *                      such as a page frame, without going through a
+ *                      kernel buffer first. NULL if not supported; use
+ *                      devop_io instead.
+ *      devop_submit - optional; start the transfer described by a
+ *                     struct devreq (see above) and return without
+ *                     waiting for it. Fails without calling DR_DONE
+ *                     if the request is no good. NULL if not
+ *                     supported.
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_frameio)(struct device *, paddr_t pa, size_t len,
+			     off_t pos, enum uio_rw rw);
+	int (*devop_submit)(struct device *, struct devreq *req);
 };
 
 /*
@@ -69,6 +113,9 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#define DEVOP_FRAMEIO(d, pa, l, o, rw) \
+	((d)->d_ops->devop_frameio(d, pa, l, o, rw))
+#define DEVOP_SUBMIT(d, r)	((d)->d_ops->devop_submit(d, r))
 
 
 /* Create vnode for a vfs-level device. */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _DISKSTAT_H_
+#define _DISKSTAT_H_
+
+/*
+ * Per-disk I/O statistics.
+ *
+ * A disk driver keeps a struct diskstats for each disk, registers it
+ * with diskstats_attach when the disk attaches, and points the disk's
+ * struct device at it (d_stats) so filesystems can report retries.
+ * The driver calls diskstats_start when it queues a request and
+ * diskstats_done when the request finishes, passing the time it was
+ * queued; both may be called from interrupt handlers.
+ *
+ * Functions:
+ *     diskstats_attach - set up DK for disk NAME and make it visible.
+ *     diskstats_start  - count a request as in flight.
+ *     diskstats_done   - count a finished request of NSECT sectors in
+ *                        direction RW, queued at QUEUED.
+ *     diskstats_retry  - count a request being tried again.
+ *     diskstats_get    - copy out the statistics for the disk that
+ *                        attached UNITth (from 0). ENODEV if there's
+ *                        no such disk.
+ *     diskstats_print  - print everything, for the kernel menu.
+ *
+ * The structure handed out is struct diskstat, in <kern/diskstat.h>.
+ */
+
+#include <spinlock.h>
+#include <uio.h>
+#include <kern/diskstat.h>
+
+struct timespec;
+
+struct diskstats {
+	struct spinlock dk_lock;
+	struct diskstat dk_stat;
+};
+
+void diskstats_attach(struct diskstats *dk, const char *name,
+		      uint32_t nsectors, uint32_t sectsize);
+void diskstats_start(struct diskstats *dk);
+void diskstats_done(struct diskstats *dk, enum uio_rw rw, uint32_t nsect,
+		    const struct timespec *queued, int result);
+void diskstats_retry(struct diskstats *dk);
+int diskstats_get(unsigned unit, struct diskstat *ret);
+void diskstats_print(void);
+
+#endif /* _DISKSTAT_H_ */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_DISKSTAT_H_
+#define _KERN_DISKSTAT_H_
+
+/*
+ * Disk I/O statistics, as returned by __diskstat().
+ *
+ * Requests are counted when they finish. The latency of a request is
+ * the time from when it was queued to when the disk finished it, in
+ * microseconds. Latencies go into a log2 histogram: bucket I counts
+ * requests that took at least 2^I and less than 2^(I+1) microseconds,
+ * except that the first bucket also counts anything quicker and the
+ * last anything slower.
+ */
+
+#define DS_NAMELEN   16		/* longest device name, plus null */
+#define DS_NBUCKETS  24		/* latency histogram buckets */
+
+struct diskstat {
+	char ds_name[DS_NAMELEN];	/* device name, e.g. "lhd0" */
+	__u32 ds_nsectors;		/* size of the disk */
+	__u32 ds_sectsize;		/* bytes per sector */
+
+	__u32 ds_reads;			/* read requests finished */
+	__u32 ds_writes;		/* write requests finished */
+	__u64 ds_rsectors;		/* sectors read */
+	__u64 ds_wsectors;		/* sectors written */
+	__u32 ds_errors;		/* requests that failed */
+	__u32 ds_retries;		/* requests retried after EIO */
+	__u32 ds_inflight;		/* requests queued or in progress */
+	__u32 ds_maxinflight;		/* most ever at once */
+
+	__u64 ds_rusec;			/* total read latency */
+	__u64 ds_wusec;			/* total write latency */
+	__u32 ds_rhist[DS_NBUCKETS];	/* read latency histogram */
+	__u32 ds_whist[DS_NBUCKETS];	/* write latency histogram */
+};
+
+#endif /* _KERN_DISKSTAT_H_ */
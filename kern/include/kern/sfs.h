@@ -41,8 +41,8 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
@@ -86,7 +86,10 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Doubly indirect block */
+	uint32_t sfi_tindirect;			/* Triply indirect block */
+	uint32_t sfi_dirbuckets;		/* Hash buckets (dirs only) */
+	uint32_t sfi_waste[128-6-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
 /*
@@ -97,5 +100,27 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Directory index.
+ *
+ * A directory is an array of sfs_direntry; free slots have sfd_ino
+ * set to SFS_NOINO. A directory with sfi_dirbuckets == 0 is linear
+ * and a name may be in any slot.
+ *
+ * Otherwise the directory is indexed: it is exactly sfi_dirbuckets
+ * blocks long (a power of two) and each block is a hash bucket. A
+ * name's home bucket is hash(name) % sfi_dirbuckets; the name may be
+ * stored there or, if that is full, in the buddy bucket whose number
+ * differs only in the lowest bit.
+ * An indexed directory is still a valid linear directory, so clearing
+ * sfi_dirbuckets is always a safe way to drop the index.
+ *
+ * The hash is 32-bit FNV-1a over the bytes of the name.
+ */
+#define SFS_DIRBUCKET_ENTRIES  (SFS_BLOCKSIZE/sizeof(struct sfs_direntry))
+#define SFS_DIR_MAXBUCKETS     4096
+#define SFS_DIRHASH_BASIS      2166136261U
+#define SFS_DIRHASH_PRIME      16777619U
+
 
 #endif /* _KERN_SFS_H_ */
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A kmem_cache hands out objects of one fixed size, built on kmalloc.
+ * Freed objects are kept in the cache still constructed, so the next
+ * allocation gets one back without the work of setting it up again.
+ *
+ * The constructor, if any, is called when an object is first
+ * allocated from the heap; it returns 0 or an error code, and on
+ * failure the object is released again. The destructor, if any, is
+ * called just before an object goes back to the heap. An object
+ * coming out of kmem_cache_alloc is thus in whatever state the
+ * constructor leaves it in, or whatever state it was in when passed
+ * to kmem_cache_free; the caller should put it back in the same state
+ * before freeing it, and initialize the rest itself.
+ *
+ * At most KMEM_CACHE_DEPTH objects are kept per cache; objects
+ * beyond that are destroyed when freed.
+ *
+ * Functions:
+ *     kmem_cache_create  - create a cache for objects of SIZE bytes.
+ *     kmem_cache_destroy - destroy all cached objects and the cache.
+ *                          Objects that are still allocated must not
+ *                          be freed to the cache afterwards.
+ *     kmem_cache_init    - like kmem_cache_create, for a cache the
+ *                          caller has storage for.
+ *     kmem_cache_cleanup - like kmem_cache_destroy, for a cache set up
+ *                          with kmem_cache_init.
+ *     kmem_cache_alloc   - get an object. Returns NULL if out of
+ *                          memory or the constructor fails.
+ *     kmem_cache_free    - return an object.
+ *     kmem_cache_reap    - destroy all the cached objects.
+ *     kmem_cache_reapall - kmem_cache_reap every cache that has any.
+ *
+ * Caches can also be initialized statically with
+ * KMEM_CACHE_INITIALIZER, which is how caches that are needed before
+ * anything has been bootstrapped get set up.
+ */
+
+#include <spinlock.h>
+
+#define KMEM_CACHE_DEPTH 32
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;
+	unsigned kc_nfree;			/* objects in kc_free */
+	void *kc_free[KMEM_CACHE_DEPTH];	/* constructed free objects */
+	bool kc_listed;				/* on the list of caches */
+	struct kmem_cache *kc_next;		/* next on the list */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ name, size, ctor, dtor, SPINLOCK_INITIALIZER, 0, { NULL }, \
+	  false, NULL }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void kmem_cache_init(struct kmem_cache *kc, const char *name, size_t size,
+		     int (*ctor)(void *obj), void (*dtor)(void *obj));
+void kmem_cache_cleanup(struct kmem_cache *kc);
+
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+void kmem_cache_reap(struct kmem_cache *kc);
+void kmem_cache_reapall(void);
+
+
+#endif /* _KMEMCACHE_H_ */
@@ -135,6 +135,13 @@ void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
 
+/*
+ * Per-cpu kmalloc cache, attached to each cpu when it's created.
+ * Returns NULL if kmalloc isn't using per-cpu caches.
+ */
+struct kmalloc_cpucache;
+struct kmalloc_cpucache *kmalloc_cpucache_create(void);
+
 /*
  * C string functions.
  *
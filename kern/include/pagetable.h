@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for user address spaces.
+ *
+ * The top 10 bits of a virtual address index the directory, the
+ * next 10 bits index a second-level table of page table entries,
+ * and the low 12 bits are the page offset. Second-level tables are
+ * one page each and are only allocated once something in the 4M
+ * range they cover is touched. Only kuseg is covered, so the
+ * directory has half as many entries as the address bits suggest.
+ *
+ * The hardware-visible part of an entry (PTE_FRAME, PTE_WRITE,
+ * PTE_VALID) is machine-dependent and comes from <machine/vm.h>.
+ * An entry that is not PTE_VALID is either zero (never touched),
+ * PTE_SWAPPED, in which case the frame field holds the swap slot the
+ * page lives in, or PTE_INTRANSIT, in which case the page is still in
+ * the frame but is being paged out. The only software bit a valid
+ * entry can have is PTE_NOREF, which the pageout clock sets when it
+ * clears the page's referenced bit; the TLB refill code won't load
+ * such an entry, so the next use of the page goes through vm_fault,
+ * which marks the page referenced and clears PTE_NOREF.
+ *
+ * The layout of the table is also known to the TLB refill code in
+ * the MIPS exception handler, which walks it directly.
+ *
+ * Functions:
+ *     pt_create  - allocate an empty page table. Returns NULL on error.
+ *     pt_destroy - free the page table and every page and swap slot
+ *                  it maps.
+ *     pt_lookup  - return a pointer to the entry for VADDR. If CREATE
+ *                  is set, allocate the second-level table if needed;
+ *                  otherwise return NULL if there isn't one. Also
+ *                  returns NULL if out of memory.
+ *     pt_copy    - map every page mapped in SRC into the (empty) page
+ *                  table DST as well, copy-on-write: the pages are
+ *                  shared and both mappings lose PTE_WRITE. Pages
+ *                  that are in swap are read in for DST, owned by
+ *                  NEWAS. Stale writable TLB entries for SRC must be
+ *                  flushed by the caller.
+ *
+ * The caller is responsible for synchronization (normally this is
+ * the address space lock).
+ */
+
+#include <machine/vm.h>
+
+struct addrspace;
+
+typedef uint32_t pte_t;
+
+/* Software bits. */
+#define PTE_SWAPPED      0x00000001	/* page is in swap, not in memory */
+#define PTE_INTRANSIT    0x00000002	/* page is being written to swap */
+#define PTE_NOREF        0x00000004	/* valid, but unused since the clock */
+
+#define PTE_SWAPSLOT(pte)  ((pte) >> 12)
+#define PTE_MKSWAP(slot)   (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+#define PT_NENTRIES    1024			/* entries per table */
+#define PT_NDIR        (USERSPACETOP >> 22)	/* directory entries */
+#define PT_DIRINDEX(va)  ((va) >> 22)
+#define PT_TABINDEX(va)  (((va) >> 12) & (PT_NENTRIES - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int pt_copy(struct pagetable *src, struct pagetable *dst,
+	    struct addrspace *newas);
+
+
+#endif /* _PAGETABLE_H_ */
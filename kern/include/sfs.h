@@ -56,6 +56,12 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	uint32_t sv_ranext;             /* block a sequential read wants next */
+	uint32_t sv_raend;              /* read-ahead issued up to here */
+	daddr_t sv_resblock;            /* first block reserved for us */
+	unsigned sv_rescount;           /* number of blocks reserved */
+	struct sfs_vnode *sv_hashnext;  /* vnode hash chain */
+	unsigned sv_index;              /* our slot in sfs_vnodes */
 };
 
 /*
@@ -67,8 +73,13 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnhash;  /* same, hashed by inode number */
+	unsigned sfs_vnhashsize;        /* buckets in sfs_vnhash */
+	unsigned sfs_nvnodes;           /* vnodes loaded now */
+	unsigned sfs_peakvnodes;        /* most vnodes loaded at once */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct sfs_fs *sfs_mountnext;   /* next mounted volume */
 };
 
 /*
@@ -76,5 +87,18 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Print vnode table statistics for each mounted sfs, for the kernel
+ * menu.
+ */
+void sfs_printstats(void);
+
+/*
+ * Read-ahead window, in blocks, for sequential reads. May be changed
+ * on the fly (the "ra" menu command does this); 0 turns read-ahead
+ * off.
+ */
+extern unsigned sfs_readahead_window;
+
 
 #endif /* _SFS_H_ */
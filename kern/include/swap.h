@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * The swap device is divided into page-sized slots, tracked with a
+ * bitmap. Slot numbers are stored in page table entries (see
+ * PTE_MKSWAP in <pagetable.h>).
+ *
+ * Functions:
+ *     swap_bootstrap - attach SWAP_DEVICE if it exists. Without it
+ *                      the system runs with no swap.
+ *     swap_enabled   - return true if there is swap space.
+ *     swap_alloc     - allocate a free slot. Returns ENOSPC if there
+ *                      isn't one.
+ *     swap_allocrun  - allocate NSLOTS consecutive free slots and
+ *                      return the first. Returns ENOSPC if there is
+ *                      no such run.
+ *     swap_free      - release a slot.
+ *     swap_pageout   - write physical page PA to SLOT.
+ *     swap_pageoutv  - write the NPAGES physical pages in PAS to
+ *                      consecutive slots starting at SLOT, as one
+ *                      transfer. NPAGES may be at most SWAP_MAXBATCH.
+ *     swap_pagein    - read SLOT into physical page PA.
+ *
+ * swap_pageout and swap_pagein sleep, and must not allocate memory,
+ * since they are called when memory has run out.
+ */
+
+/* The raw disk used for swap. */
+#define SWAP_DEVICE  "lhd0:"
+
+/* Slot numbers must fit in 20 bits (the frame field of a PTE). */
+#define SWAP_MAXSLOTS  (1U << 20)
+
+/* Most pages written in one swap_pageoutv. */
+#define SWAP_MAXBATCH  16
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(unsigned *slot);
+int swap_allocrun(unsigned nslots, unsigned *slot);
+void swap_free(unsigned slot);
+int swap_pageout(paddr_t pa, unsigned slot);
+int swap_pageoutv(const paddr_t *pas, unsigned npages, unsigned slot);
+int swap_pagein(paddr_t pa, unsigned slot);
+
+
+#endif /* _SWAP_H_ */
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _TIMEOUT_H_
+#define _TIMEOUT_H_
+
+/*
+ * Timeouts: calling a function at a given time in the future.
+ *
+ * Each CPU keeps its pending timeouts in a timer wheel: a ring of
+ * TIMEOUT_WHEELSIZE slots, each covering 2^TIMEOUT_SLOTSHIFT
+ * nanoseconds, with a timeout going in the slot for its deadline.
+ * Finding the next timeout to go off means looking through at most
+ * one turn of the wheel, so CPUs don't have to tick to find out
+ * whether anything is due. Instead, the CPU's timer is programmed
+ * to go off exactly when the next timeout is due (or at the next
+ * scheduling tick, if that's sooner and the CPU is busy); see
+ * hardclock() in clock.c.
+ *
+ * Functions:
+ *     timeout_init - set up TO to call FUNC(ARG).
+ *     timeout_add  - arrange for TO to go off DELAY from now, on the
+ *                    current CPU. If it was already pending, it's
+ *                    moved.
+ *     timeout_del  - cancel TO. Returns true if it was pending, or
+ *                    false if it wasn't, in which case the function
+ *                    may have been called already or be running
+ *                    right now on another CPU; the caller must allow
+ *                    for that before reusing the timeout or the
+ *                    memory it's in.
+ *
+ * The function is called from the timer interrupt, on the CPU that
+ * added the timeout, with no locks held. It must not sleep, but may
+ * wake threads up or add timeouts (including itself again).
+ *
+ * Timeouts can't be used until clock_start has been called, which
+ * happens once the devices have been probed.
+ */
+
+#include <spinlock.h>
+
+struct cpu;
+struct timespec;
+
+/* Slot width (about 8.4 ms) and number of slots (power of two). */
+#define TIMEOUT_SLOTSHIFT	23
+#define TIMEOUT_WHEELSIZE	64
+
+/* A time that never comes. */
+#define TIMEOUT_NEVER		0xffffffffffffffffULL
+
+struct timeout {
+	uint64_t to_deadline;		/* when, in nanoseconds */
+	uint64_t to_tick;		/* slot number (not wrapped) */
+	void (*to_func)(void *);	/* what to call */
+	void *to_arg;
+	struct cpu *volatile to_cpu;	/* wheel it's on, or NULL */
+	struct timeout *to_next;	/* slot list */
+	struct timeout **to_prevp;
+};
+
+/*
+ * One CPU's timer wheel. TW_LASTRUN is the time up to which
+ * everything due has been run; slots for earlier times are empty.
+ */
+struct timeoutwheel {
+	struct spinlock tw_lock;
+	struct timeout *tw_slots[TIMEOUT_WHEELSIZE];
+	unsigned tw_count;		/* pending timeouts */
+	uint64_t tw_lastrun;		/* see above */
+	uint64_t tw_armed;		/* when the timer will go off */
+	uint64_t tw_nexttick;		/* next scheduling tick, if busy */
+};
+
+void timeoutwheel_init(struct timeoutwheel *tw);
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_add(struct timeout *to, const struct timespec *delay);
+bool timeout_del(struct timeout *to);
+
+#endif /* _TIMEOUT_H_ */
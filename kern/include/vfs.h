@@ -183,6 +183,34 @@ int vfs_swapon(const char *devname, struct vnode **result);
 int vfs_swapoff(const char *devname);
 int vfs_unmountall(void);
 
+/*
+ * Name cache. Remembers the result of looking up single pathname
+ * components in directories, including names that don't exist, so
+ * repeated lookups don't have to go to the filesystem. Entries hold
+ * references to the vnodes involved. Must be called with the
+ * vfs_biglock held.
+ *
+ *    vfs_cache_bootstrap - Call during VFS initialization.
+ *    vfs_cache_lookup - Look up NAME in DIR. Returns false if not
+ *                       cached; otherwise true, with *RESULT set to a
+ *                       new reference to the vnode, or NULL if the
+ *                       name is known not to exist.
+ *    vfs_cache_enter  - Record that NAME in DIR is VN, or does not
+ *                       exist if VN is NULL.
+ *    vfs_cache_purge  - Forget NAME in DIR (and, if it was a
+ *                       directory, anything cached inside it). Call
+ *                       whenever NAME is created, removed, or renamed.
+ *    vfs_cache_purgefs - Forget everything on filesystem FS, so it
+ *                       can be unmounted.
+ */
+
+void vfs_cache_bootstrap(void);
+bool vfs_cache_lookup(struct vnode *dir, const char *name,
+		      struct vnode **result);
+void vfs_cache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_cache_purge(struct vnode *dir, const char *name);
+void vfs_cache_purgefs(struct fs *fs);
+
 /*
  * Array of vnodes.
  */
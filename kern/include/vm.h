@@ -55,6 +55,15 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Allocate kernel heap pages that are virtually but not necessarily
+ * physically contiguous. Returns 0 if this can't be done right now;
+ * try alloc_kpages. Free them with free_kpages. Doesn't sleep when
+ * called from an interrupt or with a spinlock held. (Not in dumbvm.)
+ */
+vaddr_t alloc_kvpages(unsigned npages);
+void free_kvpages(vaddr_t addr);
+
 /*
  * Return amount of memory (in bytes) used by allocated coremap pages.  If
  * there are ongoing allocations, this value could change after it is returned
@@ -65,5 +74,30 @@ unsigned int coremap_used_bytes(void);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Invalidate every entry in the current CPU's TLB */
+void vm_flushtlb(void);
+
+/*
+ * Batched TLB invalidation. Add ranges of pages of one or more
+ * address spaces (NULL for kernel mappings) to a batch, then flush
+ * it to invalidate them on every CPU that may have them cached.
+ * vm_tlbbatch_add flushes the batch itself if it fills up. Flushing
+ * may sleep.
+ */
+struct addrspace;
+void vm_tlbbatch_init(struct tlbbatch *tb);
+void vm_tlbbatch_add(struct tlbbatch *tb, struct addrspace *as,
+		     vaddr_t start, unsigned npages);
+void vm_tlbbatch_flush(struct tlbbatch *tb);
+
+/* Invalidate one page of AS on every CPU; may sleep */
+void vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr);
+
+/* Make AS (or nothing, if NULL) the address space the MMU uses */
+void vm_activate(struct addrspace *as);
+
+/* Make sure the MMU no longer refers to AS, which is being destroyed */
+void vm_destroyas(struct addrspace *as);
+
 
 #endif /* _VM_H_ */
@@ -47,11 +47,103 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * Maps of at least this many bits also keep a summary: one bit per
+ * word of v[], set when that word is completely full. Scanning the
+ * summary 32 words at a time lets allocation skip over long runs of
+ * full space (the front of a big, mostly-full disk) without touching
+ * each byte of it. Small maps aren't worth the extra memory.
+ */
+#define BITMAP_SUMMARY_MINBITS  2048
+#define SUMMARY_BITS            32
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned hint;          /* where bitmap_alloc looks first */
+        uint32_t *summary;      /* full-word summary, or NULL */
+        bool summaryvalid;      /* false after v[] was handed out */
 };
 
+/*
+ * Count trailing zeros of a nonzero 32-bit value. Isolate the lowest
+ * set bit and use a de Bruijn multiply to look up its position. (We
+ * can't count on __builtin_ctz: MIPS-I has no instruction for it and
+ * the kernel doesn't link with libgcc.)
+ */
+static const unsigned char bitmap_debruijn[32] = {
+        0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+        31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+};
+
+static
+inline
+unsigned
+bitmap_ctz(uint32_t x)
+{
+        KASSERT(x != 0);
+        return bitmap_debruijn[((x & -x) * 0x077cb531U) >> 27];
+}
+
+/*
+ * Index of the lowest clear bit in a word that isn't full.
+ */
+static
+inline
+unsigned
+bitmap_ffz(WORD_TYPE w)
+{
+        KASSERT(w != WORD_ALLBITS);
+        return bitmap_ctz(~(uint32_t)w);
+}
+
+static
+inline
+void
+bitmap_setfull(struct bitmap *b, unsigned ix)
+{
+        if (b->summary != NULL) {
+                b->summary[ix / SUMMARY_BITS] |=
+                        (uint32_t)1 << (ix % SUMMARY_BITS);
+        }
+}
+
+static
+inline
+void
+bitmap_clearfull(struct bitmap *b, unsigned ix)
+{
+        if (b->summary != NULL) {
+                b->summary[ix / SUMMARY_BITS] &=
+                        ~((uint32_t)1 << (ix % SUMMARY_BITS));
+        }
+}
+
+/*
+ * (Re)compute the summary from v[]. Summary bits past the last word
+ * are set, so they look full and are never chosen.
+ */
+static
+void
+bitmap_summarize(struct bitmap *b)
+{
+        unsigned words = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        unsigned nsum = DIVROUNDUP(words, SUMMARY_BITS);
+        unsigned ix;
+
+        if (b->summary == NULL) {
+                return;
+        }
+        for (ix=0; ix<nsum; ix++) {
+                b->summary[ix] = 0xffffffff;
+        }
+        for (ix=0; ix<words; ix++) {
+                if (b->v[ix] != WORD_ALLBITS) {
+                        bitmap_clearfull(b, ix);
+                }
+        }
+        b->summaryvalid = true;
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
@@ -69,9 +161,20 @@ bitmap_create(unsigned nbits)
                 kfree(b);
                 return NULL;
         }
+        b->summary = NULL;
+        if (nbits >= BITMAP_SUMMARY_MINBITS) {
+                b->summary = kmalloc(DIVROUNDUP(words, SUMMARY_BITS) *
+                                     sizeof(uint32_t));
+                if (b->summary == NULL) {
+                        kfree(b->v);
+                        kfree(b);
+                        return NULL;
+                }
+        }
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -86,38 +189,119 @@ bitmap_create(unsigned nbits)
                 }
         }
 
+        bitmap_summarize(b);
         return b;
 }
 
 void *
 bitmap_getdata(struct bitmap *b)
 {
+        /*
+         * The caller may write the bits directly (e.g. loading them
+         * from disk), so rebuild the summary before trusting it again.
+         */
+        b->summaryvalid = false;
         return b->v;
 }
 
+/*
+ * Return the index of the first word in [from, to) that isn't full,
+ * or TO if there isn't one.
+ */
+static
+unsigned
+bitmap_nextfree(struct bitmap *b, unsigned from, unsigned to)
+{
+        uint32_t bits;
+        unsigned sw;
+
+        if (b->summary == NULL) {
+                for (; from < to; from++) {
+                        if (b->v[from] != WORD_ALLBITS) {
+                                return from;
+                        }
+                }
+                return to;
+        }
+
+        while (from < to) {
+                sw = from / SUMMARY_BITS;
+                bits = ~b->summary[sw] &
+                        (0xffffffff << (from % SUMMARY_BITS));
+                if (bits != 0) {
+                        from = sw*SUMMARY_BITS + bitmap_ctz(bits);
+                        return from < to ? from : to;
+                }
+                from = (sw+1) * SUMMARY_BITS;
+        }
+        return to;
+}
+
+/*
+ * Find and set the first clear bit at or after START, wrapping
+ * around at the end of the map.
+ */
+static
 int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+bitmap_allocfrom(struct bitmap *b, unsigned start, unsigned *index)
 {
-        unsigned ix;
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned ix, offset;
+        WORD_TYPE w;
+
+        if (b->summary != NULL && !b->summaryvalid) {
+                bitmap_summarize(b);
+        }
+        if (start >= b->nbits) {
+                start = 0;
+        }
+        ix = start / BITS_PER_WORD;
+        offset = start % BITS_PER_WORD;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
+        /* Bits at or after START in its own word. */
+        w = b->v[ix] | (WORD_TYPE)((1U << offset) - 1);
+        if (w == WORD_ALLBITS) {
+                /* Then the rest of the map, then the beginning. */
+                ix = bitmap_nextfree(b, ix + 1, maxix);
+                if (ix == maxix) {
+                        ix = bitmap_nextfree(b, 0, start / BITS_PER_WORD + 1);
+                        if (ix == start / BITS_PER_WORD + 1) {
+                                return ENOSPC;
                         }
-                        KASSERT(0);
                 }
+                w = b->v[ix];
         }
-        return ENOSPC;
+
+        offset = bitmap_ffz(w);
+        b->v[ix] |= ((WORD_TYPE)1) << offset;
+        if (b->v[ix] == WORD_ALLBITS) {
+                bitmap_setfull(b, ix);
+        }
+        *index = (ix*BITS_PER_WORD)+offset;
+        KASSERT(*index < b->nbits);
+        return 0;
+}
+
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        int result;
+
+        /*
+         * Carry on from where the last allocation left off, rather
+         * than rescanning the (probably full) front of the map.
+         */
+        result = bitmap_allocfrom(b, b->hint, index);
+        if (result == 0) {
+                b->hint = *index + 1;
+        }
+        return result;
+}
+
+int
+bitmap_alloc_near(struct bitmap *b, unsigned goal, unsigned *index)
+{
+        return bitmap_allocfrom(b, goal, index);
 }
 
 static
@@ -142,6 +326,9 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        if (b->v[ix] == WORD_ALLBITS) {
+                bitmap_setfull(b, ix);
+        }
 }
 
 void
@@ -155,6 +342,7 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        bitmap_clearfull(b, ix);
 }
 
 
@@ -171,6 +359,9 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        if (b->summary != NULL) {
+                kfree(b->summary);
+        }
         kfree(b->v);
         kfree(b);
 }
@@ -121,6 +121,8 @@ boot(void)
 	KASSERT(curthread->t_curspl == 0);
 	/* Now do pseudo-devices. */
 	pseudoconfig();
+	/* With the clock attached, timeouts can be used. */
+	clock_start();
 	kprintf("\n");
 	kheap_nextgeneration();
 
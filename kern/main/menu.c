@@ -41,6 +41,7 @@
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <diskstat.h>
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
@@ -463,6 +464,66 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command for printing disk I/O statistics.
+ */
+static
+int
+cmd_iostat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	diskstats_print();
+
+	return 0;
+}
+
+#if OPT_SFS
+/*
+ * Command for printing sfs vnode table statistics.
+ */
+static
+int
+cmd_vnstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting the sfs read-ahead window.
+ */
+static
+int
+cmd_readahead(int nargs, char **args)
+{
+	int window;
+
+	if (nargs == 2) {
+		window = atoi(args[1]);
+		if (window < 0) {
+			kprintf("ra: window must not be negative\n");
+			return EINVAL;
+		}
+		sfs_readahead_window = window;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: ra [blocks]\n");
+		return EINVAL;
+	}
+
+	kprintf("Read-ahead window: %u blocks%s\n", sfs_readahead_window,
+		sfs_readahead_window == 0 ? " (off)" : "");
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -555,6 +616,11 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[iostat]  Disk I/O statistics       ",
+#if OPT_SFS
+	"[vnstat]  SFS vnode statistics      ",
+	"[ra]      Read-ahead window         ",
+#endif
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
@@ -710,6 +776,11 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "iostat",	cmd_iostat },
+#if OPT_SFS
+	{ "vnstat",	cmd_vnstat },
+	{ "ra",		cmd_readahead },
+#endif
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
@@ -42,6 +42,11 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
+ * With the real VM system the loading step is skipped: each segment
+ * is defined as a region backed by the executable itself, and pages
+ * are read in by vm_fault as the program touches them. Only dumbvm,
+ * which cannot do that, reads the segments in here.
+ *
  * If you wanted to support memory-mapped executables you would need
  * to rearrange this to map each segment.
  *
@@ -60,6 +65,7 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -144,6 +150,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -243,11 +250,18 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > "
+				"segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
 					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  ph.p_flags & PF_X,
+					  v, ph.p_offset, ph.p_filesz);
 		if (result) {
 			return result;
 		}
@@ -258,6 +272,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
+#if OPT_DUMBVM
+
 	/*
 	 * Now actually load each segment.
 	 */
@@ -295,6 +311,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return result;
 		}
 	}
+#endif /* OPT_DUMBVM */
 
 	result = as_complete_load(as);
 	if (result) {
@@ -28,42 +28,43 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
+#define BIGTESTSIZE 20011	/* big enough to get a summary */
 
-int
-bitmaptest(int nargs, char **args)
+static
+void
+bitmaptest_one(unsigned size)
 {
 	struct bitmap *b;
-	char data[TESTSIZE];
+	char *data;
 	uint32_t x;
-	int i;
+	unsigned i;
 
-	(void)nargs;
-	(void)args;
+	data = kmalloc(size);
+	KASSERT(data != NULL);
 
-	kprintf("Starting bitmap test...\n");
-
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		data[i] = random()%2;
 	}
 
-	b = bitmap_create(TESTSIZE);
+	b = bitmap_create(size);
 	KASSERT(b != NULL);
 
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		KASSERT(bitmap_isset(b, i)==0);
 	}
 
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		if (data[i]) {
 			bitmap_mark(b, i);
 		}
 	}
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		if (data[i]) {
 			KASSERT(bitmap_isset(b, i));
 		}
@@ -72,7 +73,7 @@ bitmaptest(int nargs, char **args)
 		}
 	}
 
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		if (data[i]) {
 			bitmap_unmark(b, i);
 		}
@@ -80,7 +81,7 @@ bitmaptest(int nargs, char **args)
 			bitmap_mark(b, i);
 		}
 	}
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		if (data[i]) {
 			KASSERT(bitmap_isset(b, i)==0);
 		}
@@ -90,17 +91,44 @@ bitmaptest(int nargs, char **args)
 	}
 
 	while (bitmap_alloc(b, &x)==0) {
-		KASSERT(x < TESTSIZE);
+		KASSERT(x < size);
 		KASSERT(bitmap_isset(b, x));
 		KASSERT(data[x]==1);
 		data[x] = 0;
 	}
 
-	for (i=0; i<TESTSIZE; i++) {
+	for (i=0; i<size; i++) {
 		KASSERT(bitmap_isset(b, i));
 		KASSERT(data[i]==0);
 	}
 
+	/* alloc_near takes the first free bit at or after the goal */
+	bitmap_unmark(b, 3);
+	bitmap_unmark(b, size/2);
+	bitmap_unmark(b, size/2 + 1);
+	KASSERT(bitmap_alloc_near(b, size/2 + 1, &x)==0);
+	KASSERT(x == size/2 + 1);
+	KASSERT(bitmap_alloc_near(b, size/2 + 1, &x)==0);
+	KASSERT(x == 3);
+	KASSERT(bitmap_alloc_near(b, 0, &x)==0);
+	KASSERT(x == size/2);
+	KASSERT(bitmap_alloc_near(b, 0, &x)==ENOSPC);
+
+	bitmap_destroy(b);
+	kfree(data);
+}
+
+int
+bitmaptest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting bitmap test...\n");
+
+	bitmaptest_one(TESTSIZE);
+	bitmaptest_one(BIGTESTSIZE);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
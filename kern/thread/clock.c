@@ -30,20 +30,24 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spl.h>
 #include <wchan.h>
 #include <clock.h>
+#include <timeout.h>
+#include <mainbus.h>
 #include <thread.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Each CPU's timer goes off when the next thing it has to do is due:
+ * a timeout (see <timeout.h>), or, if the CPU is busy, a scheduling
+ * tick. Idle CPUs don't tick.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
- * skimp on that because we have a known-good hardware clock.
+ * skimp on that because we have a known-good hardware clock. We use
+ * it for timeouts too, as nanoseconds.
  */
 
 /*
@@ -53,11 +57,20 @@
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+/* Length of a scheduling tick. */
+#define TICK_NSECS		(1000000000 / HZ)
+
+/* Longest we ever set the timer for, even with nothing to do. */
+#define CLOCK_MAXWAIT_NSECS	1000000000
+
+/* Set once the time-of-day clock is there to use. */
+static bool clock_started;
+
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Threads in clocksleep wait here until their timeout goes off.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+static struct wchan *clocksleep_wchan;
+static struct spinlock clocksleep_lock;
 
 /*
  * Setup.
@@ -65,32 +78,269 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	spinlock_init(&clocksleep_lock);
+	clocksleep_wchan = wchan_create("clocksleep");
+	if (clocksleep_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
 	}
 }
 
 /*
- * This is called once per second, on one processor, by the timer
- * code.
+ * Start using timeouts and stop ticking when idle. Called once the
+ * devices have been probed, so gettime works.
  */
 void
-timerclock(void)
+clock_start(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+	clock_started = true;
+}
+
+/*
+ * The time, in nanoseconds.
+ */
+static
+uint64_t
+clock_nsecs(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * A length of time, in nanoseconds. Negative ones count as zero, and
+ * absurdly long ones are cut down to a few centuries.
  */
+static
+uint64_t
+clock_duration(const struct timespec *ts)
+{
+	if (ts->tv_sec < 0 || (ts->tv_sec == 0 && ts->tv_nsec <= 0)) {
+		return 0;
+	}
+	if (ts->tv_sec >= 0x100000000LL) {
+		return (uint64_t)0x100000000LL * 1000000000;
+	}
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+////////////////////////////////////////////////////////////
+// Timer wheels
+
 void
-hardclock(void)
+timeoutwheel_init(struct timeoutwheel *tw)
+{
+	unsigned i;
+
+	spinlock_init(&tw->tw_lock);
+	for (i=0; i<TIMEOUT_WHEELSIZE; i++) {
+		tw->tw_slots[i] = NULL;
+	}
+	tw->tw_count = 0;
+	tw->tw_lastrun = 0;
+	/* Until hardclock sets it, the timer goes off within a tick. */
+	tw->tw_armed = 0;
+	tw->tw_nexttick = 0;
+}
+
+/*
+ * Put a timeout in its slot. A deadline that has already passed goes
+ * in the slot we're up to, so it's found next time we look.
+ */
+static
+void
+timeoutwheel_insert(struct timeoutwheel *tw, struct timeout *to)
+{
+	struct timeout **slot;
+	uint64_t when;
+
+	KASSERT(spinlock_do_i_hold(&tw->tw_lock));
+
+	when = to->to_deadline > tw->tw_lastrun ?
+		to->to_deadline : tw->tw_lastrun;
+	to->to_tick = when >> TIMEOUT_SLOTSHIFT;
+
+	slot = &tw->tw_slots[to->to_tick & (TIMEOUT_WHEELSIZE - 1)];
+	to->to_next = *slot;
+	if (*slot != NULL) {
+		(*slot)->to_prevp = &to->to_next;
+	}
+	to->to_prevp = slot;
+	*slot = to;
+	tw->tw_count++;
+}
+
+static
+void
+timeoutwheel_remove(struct timeoutwheel *tw, struct timeout *to)
+{
+	KASSERT(spinlock_do_i_hold(&tw->tw_lock));
+	KASSERT(tw->tw_count > 0);
+
+	*to->to_prevp = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_prevp = to->to_prevp;
+	}
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+	to->to_cpu = NULL;
+	tw->tw_count--;
+}
+
+/*
+ * Find a timeout that's due by NOW, if there is one. Only the slots
+ * from the last run up to NOW need looking at, and at most one turn
+ * of the wheel of them.
+ */
+static
+struct timeout *
+timeoutwheel_due(struct timeoutwheel *tw, uint64_t now)
+{
+	struct timeout *to;
+	uint64_t tick, last;
+
+	tick = tw->tw_lastrun >> TIMEOUT_SLOTSHIFT;
+	last = now >> TIMEOUT_SLOTSHIFT;
+	if (last - tick >= TIMEOUT_WHEELSIZE) {
+		last = tick + TIMEOUT_WHEELSIZE - 1;
+	}
+	for (; tick <= last && tw->tw_count > 0; tick++) {
+		to = tw->tw_slots[tick & (TIMEOUT_WHEELSIZE - 1)];
+		for (; to != NULL; to = to->to_next) {
+			if (to->to_deadline <= now) {
+				return to;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * When the next timeout is due. The first slot (going round from the
+ * last run) with anything in it for this turn of the wheel has the
+ * earliest ones. If there's nothing this turn, come back when the
+ * wheel has gone round.
+ */
+static
+uint64_t
+timeoutwheel_next(struct timeoutwheel *tw)
+{
+	struct timeout *to;
+	uint64_t tick, best;
+	unsigned i;
+
+	if (tw->tw_count == 0) {
+		return TIMEOUT_NEVER;
+	}
+
+	best = TIMEOUT_NEVER;
+	tick = tw->tw_lastrun >> TIMEOUT_SLOTSHIFT;
+	for (i=0; i<TIMEOUT_WHEELSIZE; i++, tick++) {
+		to = tw->tw_slots[tick & (TIMEOUT_WHEELSIZE - 1)];
+		for (; to != NULL; to = to->to_next) {
+			if (to->to_tick == tick && to->to_deadline < best) {
+				best = to->to_deadline;
+			}
+		}
+		if (best != TIMEOUT_NEVER) {
+			return best;
+		}
+	}
+	return tick << TIMEOUT_SLOTSHIFT;
+}
+
+/*
+ * Set the current CPU's timer for the next timeout or, if the CPU is
+ * busy, the next tick, whichever is sooner. Called with the CPU's
+ * wheel locked.
+ */
+static
+void
+clock_settimer(struct timeoutwheel *tw, uint64_t now)
+{
+	uint64_t next;
+
+	next = timeoutwheel_next(tw);
+	if (!curcpu->c_isidle && tw->tw_nexttick < next) {
+		next = tw->tw_nexttick;
+	}
+	if (next > now + CLOCK_MAXWAIT_NSECS) {
+		next = now + CLOCK_MAXWAIT_NSECS;
+	}
+	tw->tw_armed = next;
+	mainbus_settimer(next > now ? next - now : 0);
+}
+
+////////////////////////////////////////////////////////////
+// Timeouts
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_deadline = 0;
+	to->to_tick = 0;
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_cpu = NULL;
+	to->to_next = NULL;
+	to->to_prevp = NULL;
+}
+
+void
+timeout_add(struct timeout *to, const struct timespec *delay)
+{
+	struct timeoutwheel *tw;
+	uint64_t now;
+	int spl;
+
+	KASSERT(clock_started);
+
+	timeout_del(to);
+
+	now = clock_nsecs();
+	to->to_deadline = now + clock_duration(delay);
+
+	/* Stay on this CPU until it's on the wheel. */
+	spl = splhigh();
+	tw = &curcpu->c_timeouts;
+	spinlock_acquire(&tw->tw_lock);
+	to->to_cpu = curcpu->c_self;
+	timeoutwheel_insert(tw, to);
+	if (to->to_deadline < tw->tw_armed) {
+		clock_settimer(tw, now);
+	}
+	spinlock_release(&tw->tw_lock);
+	splx(spl);
+}
+
+bool
+timeout_del(struct timeout *to)
+{
+	struct cpu *c;
+
+	/* It might go off, or move, while we're getting the lock. */
+	while ((c = to->to_cpu) != NULL) {
+		spinlock_acquire(&c->c_timeouts.tw_lock);
+		if (to->to_cpu == c) {
+			timeoutwheel_remove(&c->c_timeouts, to);
+			spinlock_release(&c->c_timeouts.tw_lock);
+			return true;
+		}
+		spinlock_release(&c->c_timeouts.tw_lock);
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+// Clock interrupts
+
+/*
+ * A scheduling tick.
+ */
+static
+void
+hardclock_tick(void)
 {
 	/*
 	 * Collect statistics here as desired.
@@ -106,16 +356,127 @@ hardclock(void)
 	thread_yield();
 }
 
+/*
+ * This is called from the timer interrupt on each processor: HZ
+ * times a second until clock_start, and after that whenever the
+ * timer goes off. Run whatever timeouts are due (unlocked, since
+ * they may add timeouts themselves), take a tick if it's time, and
+ * set the timer for the next thing.
+ */
+void
+hardclock(void)
+{
+	struct timeoutwheel *tw;
+	struct timeout *to;
+	void (*func)(void *);
+	void *arg;
+	uint64_t now;
+	bool tick;
+
+	if (!clock_started) {
+		hardclock_tick();
+		return;
+	}
+
+	tw = &curcpu->c_timeouts;
+	now = clock_nsecs();
+
+	spinlock_acquire(&tw->tw_lock);
+	while ((to = timeoutwheel_due(tw, now)) != NULL) {
+		/* Once it's off the wheel, TO may be reused; don't touch it. */
+		func = to->to_func;
+		arg = to->to_arg;
+		timeoutwheel_remove(tw, to);
+		spinlock_release(&tw->tw_lock);
+		func(arg);
+		spinlock_acquire(&tw->tw_lock);
+	}
+	if (now > tw->tw_lastrun) {
+		tw->tw_lastrun = now;
+	}
+
+	tick = !curcpu->c_isidle && now >= tw->tw_nexttick;
+	if (tick) {
+		tw->tw_nexttick = now + TICK_NSECS;
+	}
+	clock_settimer(tw, now);
+	spinlock_release(&tw->tw_lock);
+
+	if (tick) {
+		hardclock_tick();
+	}
+}
+
+/*
+ * The current CPU was idle and has found a thread to run: start
+ * ticking again. Called from thread_switch.
+ */
+void
+clock_unidle(void)
+{
+	struct timeoutwheel *tw;
+	uint64_t now;
+
+	if (!clock_started) {
+		return;
+	}
+
+	tw = &curcpu->c_timeouts;
+	now = clock_nsecs();
+
+	spinlock_acquire(&tw->tw_lock);
+	tw->tw_nexttick = now + TICK_NSECS;
+	if (tw->tw_nexttick < tw->tw_armed) {
+		clock_settimer(tw, now);
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Sleeping
+
+static
+void
+clocksleep_wakeup(void *data)
+{
+	bool *done = data;
+
+	spinlock_acquire(&clocksleep_lock);
+	*done = true;
+	wchan_wakeall(clocksleep_wchan, &clocksleep_lock);
+	spinlock_release(&clocksleep_lock);
+}
+
+/*
+ * Suspend execution for DURATION. Once we see DONE set, the timeout
+ * has finished with both it and the timeout itself, which are on our
+ * stack.
+ */
+void
+clocknanosleep(const struct timespec *duration)
+{
+	struct timeout to;
+	bool done = false;
+
+	timeout_init(&to, clocksleep_wakeup, &done);
+	timeout_add(&to, duration);
+
+	spinlock_acquire(&clocksleep_lock);
+	while (!done) {
+		wchan_sleep(clocksleep_wchan, &clocksleep_lock);
+	}
+	spinlock_release(&clocksleep_lock);
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
-	}
-	spinlock_release(&lbolt_lock);
+	struct timespec ts;
+
+	ts.tv_sec = num_secs;
+	ts.tv_nsec = 0;
+	clocknanosleep(&ts);
 }
@@ -33,12 +33,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <kmemcache.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -138,39 +140,62 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks come from an object cache. The wait channel and spinlock are
+ * set up once by the constructor and kept while the lock sits in the
+ * cache; lock_create only has to supply the name. (The wait channel
+ * therefore can't be named after the lock.)
+ */
+static int lock_ctor(void *obj);
+static void lock_dtor(void *obj);
+
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock),
+			       lock_ctor, lock_dtor);
+
+static
+int
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->lk_wchan = wchan_create("lock");
+	if (lock->lk_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&lock->lk_lock);
+	return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+	struct lock *lock = obj;
+
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
+}
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(*lock));
+	lock = kmem_cache_alloc(&lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->lk_name = kstrdup(name);
 	if (lock->lk_name == NULL) {
-		kfree(lock);
+		kmem_cache_free(&lock_cache, lock);
 		return NULL;
 	}
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
-	
 
-	// add stuff here as needed
-	/* Here's a pattern that is usually followed in an OS
-		- allocate the struct members incrementally 
-		- if an error occurs during the allocation or init of a struct free all the previously allocated members
-		- and then return NULL which will act as an error code
-	*/
-	lock->lk_wchan = wchan_create(lock->lk_name);
-	if(lock->lk_wchan == NULL){
-		kfree(lock->lk_name);
-		kfree(lock);
-		lock = NULL;	
-
-	}
-	spinlock_init(&lock->lk_lock);	// here you are sending the address of the date member lk_lock that lock points to the function takes a spinlock * parameter
+	lock->lk_currthread = NULL;
 	lock->lk_count  = 0;
 	lock->lk_isheld = false;
 	return lock;
@@ -195,11 +220,9 @@ lock_destroy(struct lock *lock)
 	// KASSERT(wchan_isempty(lock->lk_wchan,&lock->lk_lock));
 	KASSERT(lock->lk_isheld == false);
 	
-	// add stuff here as needed
-	spinlock_cleanup(&lock->lk_lock);
-	wchan_destroy(lock->lk_wchan);
+	// the wchan and spinlock stay with the lock in the cache
 	kfree(lock->lk_name);
-	kfree(lock);
+	kmem_cache_free(&lock_cache, lock);
 }
 
 void
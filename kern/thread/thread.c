@@ -49,7 +49,9 @@
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <clock.h>
 #include <vnode.h>
+#include <kmemcache.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -75,6 +77,23 @@ unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
 static struct wchan *thread_count_wchan;
 
+/*
+ * Object caches for threads and wait channels. A cached thread keeps
+ * its kernel stack, so creating a thread doesn't usually need to
+ * allocate one.
+ */
+static int thread_ctor(void *obj);
+static void thread_dtor(void *obj);
+static int wchan_ctor(void *obj);
+static void wchan_dtor(void *obj);
+
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread),
+			       thread_ctor, thread_dtor);
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan),
+			       wchan_ctor, wchan_dtor);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -114,6 +133,32 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Constructor and destructor for thread_cache.
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_stack = NULL;
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -129,7 +174,7 @@ thread_create(const char *name)
 		return NULL;
 	}
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
@@ -140,8 +185,7 @@ thread_create(const char *name)
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* t_listnode and t_stack are set up by thread_ctor */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -184,11 +228,14 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_kmcache = NULL;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
+	timeoutwheel_init(&c->c_timeouts);
+
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
@@ -213,9 +260,12 @@ cpu_create(unsigned hardware_number)
 		 * make it possible to free the boot stack?)
 		 */
 		/*c->c_curthread->t_stack = ... */
+		KASSERT(c->c_curthread->t_stack == NULL);
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		if (c->c_curthread->t_stack == NULL) {
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		}
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -252,6 +302,9 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
 	}
 
+	/* Not fatal if this fails; kmalloc just goes the slow way. */
+	c->c_kmcache = kmalloc_cpucache_create();
+
 	cpu_machdep_init(c);
 
 	return c;
@@ -277,16 +330,13 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
-	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread);
+	/* The stack stays with the thread structure for reuse. */
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -518,11 +568,13 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless we got a recycled one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -580,6 +632,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	bool idled;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -654,19 +707,27 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * An idle cpu stops taking scheduling ticks, so if we did go
+	 * idle, start them again.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	idled = false;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
+			idled = true;
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	if (idled) {
+		clock_unidle();
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -988,6 +1049,28 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+/*
+ * Constructor and destructor for wchan_cache.
+ */
+static
+int
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_init(&wc->wc_threads);
+	return 0;
+}
+
+static
+void
+wchan_dtor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_cleanup(&wc->wc_threads);
+}
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -1001,11 +1084,11 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	threadlist_init(&wc->wc_threads);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
 	wc->wc_name = name;
 
 	return wc;
@@ -1018,8 +1101,8 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
-	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	kmem_cache_free(&wchan_cache, wc);
 }
 
 /*
@@ -1193,6 +1276,26 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to each CPU whose number is set in
+ * CPUMASK. The current CPU must not be included.
+ */
+void
+ipi_tlbshootdown_mask(uint32_t cpumask, const struct tlbshootdown *mapping)
+{
+	unsigned i;
+
+	KASSERT((cpumask & ((uint32_t)1 << curcpu->c_number)) == 0);
+
+	for (i=0; i < cpuarray_num(&allcpus) && cpumask != 0; i++) {
+		if (cpumask & ((uint32_t)1 << i)) {
+			ipi_tlbshootdown(cpuarray_get(&allcpus, i), mapping);
+			cpumask &= ~((uint32_t)1 << i);
+		}
+	}
+	KASSERT(cpumask == 0);
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -92,6 +92,8 @@ static const struct device_ops null_devops = {
 	.devop_eachopen = nullopen,
 	.devop_io = nullio,
 	.devop_ioctl = nullioctl,
+	.devop_frameio = NULL,
+	.devop_submit = NULL,
 };
 
 /*
@@ -116,6 +118,7 @@ devnull_create(void)
 	dev->d_devnumber = 0; /* assigned by vfs_adddev */
 
 	dev->d_data = NULL;
+	dev->d_stats = NULL;
 
 	result = vfs_adddev("null", dev, 0);
 	if (result) {
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Disk I/O statistics. See <diskstat.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <diskstat.h>
+
+/* Most disks we keep track of. */
+#define DISKSTATS_MAX 16
+
+/*
+ * The disks, in the order they attached. Disks attach during boot,
+ * one at a time, and never go away, so entries below
+ * diskstats_count don't change once they're there.
+ */
+static struct diskstats *diskstats_table[DISKSTATS_MAX];
+static unsigned diskstats_count;
+
+void
+diskstats_attach(struct diskstats *dk, const char *name,
+		 uint32_t nsectors, uint32_t sectsize)
+{
+	spinlock_init(&dk->dk_lock);
+	bzero(&dk->dk_stat, sizeof(dk->dk_stat));
+	snprintf(dk->dk_stat.ds_name, DS_NAMELEN, "%s", name);
+	dk->dk_stat.ds_nsectors = nsectors;
+	dk->dk_stat.ds_sectsize = sectsize;
+
+	if (diskstats_count == DISKSTATS_MAX) {
+		kprintf("diskstats: too many disks; not reporting %s\n",
+			name);
+		return;
+	}
+	diskstats_table[diskstats_count++] = dk;
+}
+
+void
+diskstats_start(struct diskstats *dk)
+{
+	struct diskstat *ds = &dk->dk_stat;
+
+	spinlock_acquire(&dk->dk_lock);
+	ds->ds_inflight++;
+	if (ds->ds_inflight > ds->ds_maxinflight) {
+		ds->ds_maxinflight = ds->ds_inflight;
+	}
+	spinlock_release(&dk->dk_lock);
+}
+
+/*
+ * Histogram bucket for a latency of USEC microseconds.
+ */
+static
+unsigned
+diskstats_bucket(uint32_t usec)
+{
+	unsigned b = 0;
+
+	while (usec > 1 && b < DS_NBUCKETS - 1) {
+		usec >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void
+diskstats_done(struct diskstats *dk, enum uio_rw rw, uint32_t nsect,
+	       const struct timespec *queued, int result)
+{
+	struct diskstat *ds = &dk->dk_stat;
+	struct timespec now, diff;
+	uint32_t usec;
+
+	gettime(&now);
+	timespec_sub(&now, queued, &diff);
+	if (diff.tv_sec >= 4000) {
+		/* (would overflow; it's in the last bucket anyway) */
+		usec = 0xffffffff;
+	}
+	else {
+		usec = diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+	}
+
+	spinlock_acquire(&dk->dk_lock);
+	KASSERT(ds->ds_inflight > 0);
+	ds->ds_inflight--;
+	if (result) {
+		ds->ds_errors++;
+	}
+	else if (rw == UIO_READ) {
+		ds->ds_reads++;
+		ds->ds_rsectors += nsect;
+		ds->ds_rusec += usec;
+		ds->ds_rhist[diskstats_bucket(usec)]++;
+	}
+	else {
+		ds->ds_writes++;
+		ds->ds_wsectors += nsect;
+		ds->ds_wusec += usec;
+		ds->ds_whist[diskstats_bucket(usec)]++;
+	}
+	spinlock_release(&dk->dk_lock);
+}
+
+void
+diskstats_retry(struct diskstats *dk)
+{
+	spinlock_acquire(&dk->dk_lock);
+	dk->dk_stat.ds_retries++;
+	spinlock_release(&dk->dk_lock);
+}
+
+int
+diskstats_get(unsigned unit, struct diskstat *ret)
+{
+	struct diskstats *dk;
+
+	if (unit >= diskstats_count) {
+		return ENODEV;
+	}
+	dk = diskstats_table[unit];
+
+	spinlock_acquire(&dk->dk_lock);
+	*ret = dk->dk_stat;
+	spinlock_release(&dk->dk_lock);
+	return 0;
+}
+
+/*
+ * Print the nonempty buckets of a latency histogram.
+ */
+static
+void
+diskstats_printhist(const char *what, const uint32_t *hist)
+{
+	unsigned i;
+
+	for (i=0; i<DS_NBUCKETS; i++) {
+		if (hist[i] == 0) {
+			continue;
+		}
+		if (i == DS_NBUCKETS - 1) {
+			kprintf("    %s %8u+ us: %u\n", what, 1U << i, hist[i]);
+		}
+		else {
+			kprintf("    %s %8u-%u us: %u\n", what,
+				i == 0 ? 0 : 1U << i, (2U << i) - 1, hist[i]);
+		}
+	}
+}
+
+void
+diskstats_print(void)
+{
+	struct diskstat ds;
+	unsigned unit;
+
+	for (unit = 0; diskstats_get(unit, &ds) == 0; unit++) {
+		kprintf("%s: %u sectors of %u bytes\n", ds.ds_name,
+			ds.ds_nsectors, ds.ds_sectsize);
+		kprintf("    %u reads, %llu sectors, avg %llu us\n",
+			ds.ds_reads, ds.ds_rsectors,
+			ds.ds_reads ? ds.ds_rusec / ds.ds_reads : 0);
+		kprintf("    %u writes, %llu sectors, avg %llu us\n",
+			ds.ds_writes, ds.ds_wsectors,
+			ds.ds_writes ? ds.ds_wusec / ds.ds_writes : 0);
+		kprintf("    %u errors, %u retries, %u in flight "
+			"(at most %u)\n", ds.ds_errors, ds.ds_retries,
+			ds.ds_inflight, ds.ds_maxinflight);
+		diskstats_printhist("read ", ds.ds_rhist);
+		diskstats_printhist("write", ds.ds_whist);
+	}
+	if (unit == 0) {
+		kprintf("No disks.\n");
+	}
+}
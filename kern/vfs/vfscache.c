@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * VFS name cache.
+ *
+ * A fixed-size table of (directory vnode, name) -> vnode entries,
+ * hashed for lookup and kept on an LRU list for replacement. A
+ * negative entry (vnode NULL) records that the name doesn't exist.
+ *
+ * Each entry holds a reference to its directory and, if positive, to
+ * the vnode it names; holding the directory reference means its
+ * pointer can't be recycled for a different vnode while the entry is
+ * still around. The references also keep the vnodes from being
+ * reclaimed, which is why filesystems have to be purged before they
+ * can be unmounted.
+ *
+ * Everything here is protected by the vfs_biglock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define NC_SIZE         256     /* number of entries */
+#define NC_BUCKETS      64      /* hash chains */
+#define NC_NAMELEN      31      /* longer names aren't cached */
+
+struct ncentry {
+	struct vnode *nc_dir;		/* directory; NULL if entry unused */
+	struct vnode *nc_vn;		/* what NAME is, or NULL if nothing */
+	char nc_name[NC_NAMELEN+1];
+	struct ncentry *nc_hashnext;	/* hash chain */
+	struct ncentry *nc_lruprev;	/* LRU list, oldest first */
+	struct ncentry *nc_lrunext;
+};
+
+static struct ncentry nc_table[NC_SIZE];
+static struct ncentry *nc_hash[NC_BUCKETS];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+
+static
+unsigned
+nc_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned hash = (uintptr_t)dir >> 4;
+
+	for (; *name != 0; name++) {
+		hash = hash*33 + (unsigned char)*name;
+	}
+	return hash % NC_BUCKETS;
+}
+
+static
+void
+nc_lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_lrutail = nc->nc_lruprev;
+	}
+	nc->nc_lruprev = nc->nc_lrunext = NULL;
+}
+
+/* Put NC at the tail (most recently used end) of the LRU list. */
+static
+void
+nc_lru_append(struct ncentry *nc)
+{
+	nc->nc_lruprev = nc_lrutail;
+	nc->nc_lrunext = NULL;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = nc;
+	}
+	else {
+		nc_lruhead = nc;
+	}
+	nc_lrutail = nc;
+}
+
+/* Put NC at the head of the LRU list, to be reused first. */
+static
+void
+nc_lru_prepend(struct ncentry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = nc;
+	}
+	else {
+		nc_lrutail = nc;
+	}
+	nc_lruhead = nc;
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+
+	for (nc = nc_hash[nc_hashfunc(dir, name)]; nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an entry out of the cache and drop its references.
+ */
+static
+void
+nc_remove(struct ncentry *nc)
+{
+	struct ncentry **pp;
+	struct vnode *dir, *vn;
+
+	KASSERT(nc->nc_dir != NULL);
+
+	pp = &nc_hash[nc_hashfunc(nc->nc_dir, nc->nc_name)];
+	while (*pp != nc) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->nc_hashnext;
+	}
+	*pp = nc->nc_hashnext;
+	nc->nc_hashnext = NULL;
+
+	nc_lru_remove(nc);
+	nc_lru_prepend(nc);
+
+	/* Clear the entry before decref, which might sleep. */
+	dir = nc->nc_dir;
+	vn = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	VOP_DECREF(dir);
+}
+
+void
+vfs_cache_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<NC_BUCKETS; i++) {
+		nc_hash[i] = NULL;
+	}
+	nc_lruhead = nc_lrutail = NULL;
+	for (i=0; i<NC_SIZE; i++) {
+		nc_table[i].nc_dir = NULL;
+		nc_table[i].nc_vn = NULL;
+		nc_table[i].nc_hashnext = NULL;
+		nc_lru_append(&nc_table[i]);
+	}
+}
+
+bool
+vfs_cache_lookup(struct vnode *dir, const char *name, struct vnode **result)
+{
+	struct ncentry *nc;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		return false;
+	}
+
+	nc_lru_remove(nc);
+	nc_lru_append(nc);
+
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+	}
+	*result = nc->nc_vn;
+	return true;
+}
+
+void
+vfs_cache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct ncentry *nc;
+	unsigned bucket;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (strlen(name) > NC_NAMELEN) {
+		return;
+	}
+
+	nc = nc_find(dir, name);
+	if (nc != NULL) {
+		nc_remove(nc);
+	}
+
+	/* Reuse the least recently used entry. */
+	nc = nc_lruhead;
+	KASSERT(nc != NULL);
+	if (nc->nc_dir != NULL) {
+		nc_remove(nc);
+		KASSERT(nc == nc_lruhead);
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	strcpy(nc->nc_name, name);
+
+	bucket = nc_hashfunc(dir, name);
+	nc->nc_hashnext = nc_hash[bucket];
+	nc_hash[bucket] = nc;
+
+	nc_lru_remove(nc);
+	nc_lru_append(nc);
+}
+
+void
+vfs_cache_purge(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+	struct vnode *vn;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		return;
+	}
+
+	vn = nc->nc_vn;
+	if (vn != NULL) {
+		/* Hold VN so the scan below can't match a recycled vnode. */
+		VOP_INCREF(vn);
+	}
+	nc_remove(nc);
+	if (vn == NULL) {
+		return;
+	}
+
+	/* If it was a directory, drop what we knew about its contents. */
+	for (i=0; i<NC_SIZE; i++) {
+		if (nc_table[i].nc_dir == vn) {
+			nc_remove(&nc_table[i]);
+		}
+	}
+	VOP_DECREF(vn);
+}
+
+void
+vfs_cache_purgefs(struct fs *fs)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<NC_SIZE; i++) {
+		if (nc_table[i].nc_dir == NULL) {
+			continue;
+		}
+		if (nc_table[i].nc_dir->vn_fs == fs ||
+		    (nc_table[i].nc_vn != NULL &&
+		     nc_table[i].nc_vn->vn_fs == fs)) {
+			nc_remove(&nc_table[i]);
+		}
+	}
+}
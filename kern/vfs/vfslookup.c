@@ -234,6 +234,90 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up one pathname component NAME in directory DIR, going through
+ * the name cache. "." and ".." are left to the filesystem.
+ */
+static
+int
+lookup_component(struct vnode *dir, char *name, struct vnode **retval)
+{
+	char tmp[NAME_MAX+1];
+	bool cacheable;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	cacheable = strcmp(name, ".") && strcmp(name, "..");
+	if (cacheable && vfs_cache_lookup(dir, name, retval)) {
+		return *retval == NULL ? ENOENT : 0;
+	}
+
+	/* VOP_LOOKUP is allowed to scribble on the name. */
+	strcpy(tmp, name);
+	result = VOP_LOOKUP(dir, tmp, retval);
+
+	if (cacheable) {
+		if (result == 0) {
+			vfs_cache_enter(dir, name, *retval);
+		}
+		else if (result == ENOENT) {
+			vfs_cache_enter(dir, name, NULL);
+		}
+	}
+	return result;
+}
+
+/*
+ * Translate PATH relative to DIR one component at a time, so that
+ * each step can be answered from the name cache.
+ */
+static
+int
+lookup_walk(struct vnode *dir, char *path, struct vnode **retval)
+{
+	struct vnode *vn, *next;
+	char *name, *s;
+	int result;
+
+	VOP_INCREF(dir);
+	vn = dir;
+
+	while (1) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == 0) {
+			break;
+		}
+
+		name = path;
+		s = strchr(path, '/');
+		if (s != NULL) {
+			*s = 0;
+			path = s+1;
+		}
+		else {
+			path += strlen(path);
+		}
+
+		if (strlen(name) > NAME_MAX) {
+			VOP_DECREF(vn);
+			return ENAMETOOLONG;
+		}
+
+		result = lookup_component(vn, name, &next);
+		VOP_DECREF(vn);
+		if (result) {
+			return result;
+		}
+		vn = next;
+	}
+
+	*retval = vn;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
@@ -263,7 +347,28 @@ vfs_lookparent(char *path, struct vnode **retval,
 		result = EINVAL;
 	}
 	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		char *last = strrchr(path, '/');
+
+		if (last != NULL && last[1] != 0) {
+			/*
+			 * Walk the directory part through the cache,
+			 * and let the filesystem handle just the last
+			 * component.
+			 */
+			struct vnode *dir;
+
+			*last = 0;
+			result = lookup_walk(startvn, path, &dir);
+			if (result == 0) {
+				result = VOP_LOOKPARENT(dir, last+1, retval,
+							buf, buflen);
+				VOP_DECREF(dir);
+			}
+		}
+		else {
+			result = VOP_LOOKPARENT(startvn, path, retval,
+						buf, buflen);
+		}
 	}
 
 	VOP_DECREF(startvn);
@@ -292,7 +397,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = lookup_walk(startvn, path, retval);
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
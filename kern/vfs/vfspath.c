@@ -40,6 +40,12 @@
 #include <vnode.h>
 
 
+/*
+ * Operations that change what a name refers to purge it from the name
+ * cache. They hold the vfs_biglock across the operation and the purge
+ * so a concurrent lookup can't cache the old answer in between.
+ */
+
 /* Does most of the work for open(). */
 int
 vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
@@ -73,7 +79,10 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
+		vfs_biglock_acquire();
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		vfs_cache_purge(dir, name);
+		vfs_biglock_release();
 
 		VOP_DECREF(dir);
 	}
@@ -145,7 +154,10 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_REMOVE(dir, name);
+	vfs_cache_purge(dir, name);
+	vfs_biglock_release();
 	VOP_DECREF(dir);
 
 	return result;
@@ -178,7 +190,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_cache_purge(olddir, oldname);
+	vfs_cache_purge(newdir, newname);
+	vfs_biglock_release();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -212,7 +228,10 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_cache_purge(newdir, newname);
+	vfs_biglock_release();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -239,7 +258,10 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_cache_purge(newdir, newname);
+	vfs_biglock_release();
 	VOP_DECREF(newdir);
 
 	return result;
@@ -285,7 +307,10 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_cache_purge(parent, name);
+	vfs_biglock_release();
 
 	VOP_DECREF(parent);
 
@@ -307,7 +332,10 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_RMDIR(parent, name);
+	vfs_cache_purge(parent, name);
+	vfs_biglock_release();
 
 	VOP_DECREF(parent);
 
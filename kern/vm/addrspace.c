@@ -30,8 +30,12 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
 #include <proc.h>
 
 /*
@@ -40,6 +44,14 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/*
+ * All the address spaces there are, for as_findmapping. This is a
+ * spinlock because the pageout code uses it with the coremap lock
+ * held.
+ */
+static struct addrspace *as_all;
+static struct spinlock as_all_lock = SPINLOCK_INITIALIZER;
+
 struct addrspace *
 as_create(void)
 {
@@ -50,28 +62,139 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_regions = NULL;
+	as->as_loading = false;
+	as->as_asid = 0;
+	as->as_cpumask = 0;
+
+	spinlock_acquire(&as_all_lock);
+	as->as_next = as_all;
+	if (as_all != NULL) {
+		as_all->as_prevp = &as->as_next;
+	}
+	as->as_prevp = &as_all;
+	as_all = as;
+	spinlock_release(&as_all_lock);
 
 	return as;
 }
 
+/*
+ * Append a new anonymous region to AS and return it, or NULL if out
+ * of memory. The caller checks for overlaps.
+ */
+static
+struct region *
+as_addregion(struct addrspace *as, vaddr_t vbase, size_t npages,
+	     bool readable, bool writeable, bool executable)
+{
+	struct region *rg, **tail;
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return NULL;
+	}
+	rg->rg_vbase = vbase;
+	rg->rg_npages = npages;
+	rg->rg_readable = readable;
+	rg->rg_writeable = writeable;
+	rg->rg_executable = executable;
+	rg->rg_vnode = NULL;
+	rg->rg_filevaddr = 0;
+	rg->rg_fileoffset = 0;
+	rg->rg_filesize = 0;
+	rg->rg_next = NULL;
+
+	for (tail = &as->as_regions; *tail != NULL; tail = &(*tail)->rg_next) {
+		/* nothing */
+	}
+	*tail = rg;
+	return rg;
+}
+
+/*
+ * Make RG backed by FILESIZE bytes of V at OFFSET, starting at
+ * virtual address FILEVADDR.
+ */
+static
+void
+as_setbacking(struct region *rg, struct vnode *v, vaddr_t filevaddr,
+	      off_t offset, size_t filesize)
+{
+	KASSERT(rg->rg_vnode == NULL);
+
+	if (v == NULL || filesize == 0) {
+		return;
+	}
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_filevaddr = filevaddr;
+	rg->rg_fileoffset = offset;
+	rg->rg_filesize = filesize;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	struct tlbbatch tb;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	lock_acquire(old->as_lock);
+
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		newrg = as_addregion(newas, rg->rg_vbase, rg->rg_npages,
+				     rg->rg_readable, rg->rg_writeable,
+				     rg->rg_executable);
+		if (newrg == NULL) {
+			lock_release(old->as_lock);
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		as_setbacking(newrg, rg->rg_vnode, rg->rg_filevaddr,
+			      rg->rg_fileoffset, rg->rg_filesize);
+	}
+
+	result = pt_copy(old->as_pt, newas->as_pt, newas);
+
 	/*
-	 * Write this.
+	 * OLD's pages are now copy-on-write (even if pt_copy failed
+	 * part way); get rid of any writable translations for them.
 	 */
+	vm_tlbbatch_init(&tb);
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_writeable) {
+			vm_tlbbatch_add(&tb, old, rg->rg_vbase,
+					rg->rg_npages);
+		}
+	}
+	vm_tlbbatch_flush(&tb);
+
+	lock_release(old->as_lock);
 
-	(void)old;
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
@@ -80,10 +203,27 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
+
+	/* Once it's off the list, nobody else looks at the page table. */
+	spinlock_acquire(&as_all_lock);
+	*as->as_prevp = as->as_next;
+	if (as->as_next != NULL) {
+		as->as_next->as_prevp = as->as_prevp;
+	}
+	spinlock_release(&as_all_lock);
 
+	vm_destroyas(as);
+	pt_destroy(as->as_pt);
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -101,19 +241,57 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	vm_activate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * The address space may be about to be destroyed; stop the
+	 * TLB refill code from walking its page table. Its TLB
+	 * entries are tagged with its ID and can stay.
 	 */
+	vm_activate(NULL);
+}
+
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Only the page table is looked at, without the address space lock;
+ * the caller (the pageout code) holds the coremap lock and the page
+ * isn't pinned, so nobody can be changing the entry we're after.
+ */
+struct addrspace *
+as_findmapping(paddr_t pa, vaddr_t vaddr)
+{
+	struct addrspace *as;
+	pte_t *pte;
+
+	spinlock_acquire(&as_all_lock);
+	for (as = as_all; as != NULL; as = as->as_next) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte != NULL &&
+		    (*pte & (PTE_FRAME | PTE_VALID)) == (pa | PTE_VALID)) {
+			break;
+		}
+	}
+	spinlock_release(&as_all_lock);
+	return as;
 }
 
 /*
@@ -122,61 +300,123 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Writes
+ * to a segment without WRITEABLE set fault, except between
+ * as_prepare_load and as_complete_load. Read and execute are not
+ * distinguished by the MIPS TLB.
+ *
+ * If V is not NULL, the segment's first FILESIZE bytes are read from
+ * V at OFFSET when the pages holding them are first touched. Nothing
+ * is read now.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
-		 int readable, int writeable, int executable)
+		 int readable, int writeable, int executable,
+		 struct vnode *v, off_t offset, size_t filesize)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t segvaddr, vtop;
+	size_t npages;
+
+	if (filesize > memsize) {
+		return EINVAL;
+	}
+	segvaddr = vaddr;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = memsize / PAGE_SIZE;
+	vtop = vaddr + memsize;
+	if (npages == 0 || vtop < vaddr ||
+	    vtop > USERSTACK - VM_STACKPAGES * PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	lock_acquire(as->as_lock);
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_vbase < vtop) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+	}
+	rg = as_addregion(as, vaddr, npages,
+			  readable != 0, writeable != 0, executable != 0);
+	if (rg != NULL) {
+		as_setbacking(rg, v, segvaddr, offset, filesize);
+	}
+	lock_release(as->as_lock);
+
+	return rg == NULL ? ENOMEM : 0;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Let the loader write into read-only segments. Pages are
+	 * allocated on demand as it touches them.
 	 */
-
-	(void)as;
+	lock_acquire(as->as_lock);
+	as->as_loading = true;
+	lock_release(as->as_lock);
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	struct tlbbatch tb;
+	vaddr_t va;
+	pte_t *pte;
+	size_t i;
+
+	lock_acquire(as->as_lock);
+	as->as_loading = false;
+	vm_tlbbatch_init(&tb);
+
+	/* Take back the write permission lent out by as_prepare_load. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_writeable) {
+			continue;
+		}
+		for (i=0; i<rg->rg_npages; i++) {
+			va = rg->rg_vbase + i * PAGE_SIZE;
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && coremap_pin(pte)) {
+				*pte &= ~PTE_WRITE;
+				coremap_unpin(*pte & PTE_FRAME);
+			}
+		}
+		vm_tlbbatch_add(&tb, as, rg->rg_vbase, rg->rg_npages);
+	}
+	vm_tlbbatch_flush(&tb);
+	lock_release(as->as_lock);
 
-	(void)as;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
 
-	(void)as;
+	lock_acquire(as->as_lock);
+	rg = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			  VM_STACKPAGES, true, true, false);
+	lock_release(as->as_lock);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
 	return 0;
 }
-
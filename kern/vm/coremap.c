@@ -0,0 +1,814 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Physical page allocator (the coremap).
+ *
+ * Until coremap_bootstrap runs we hand out memory with ram_stealmem,
+ * which cannot be given back; those pages, along with the kernel
+ * image and the coremap itself, are marked CM_FIXED and are never
+ * freed. After that every page of RAM is tracked here.
+ *
+ * Searches for free pages start from a rotating hint rather than
+ * from the bottom of memory, so that repeated small allocations do
+ * not keep rescanning the same full region.
+ *
+ * User pages are evicted to swap by the pageout daemon (or, if it
+ * can't keep up, by single-page allocations themselves). See
+ * <coremap.h> for the pinning rules that make this safe without
+ * taking the owner's address space lock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+
+/*
+ * The coremap lock also covers ram_stealmem before bootstrap, so
+ * that the handoff from ram.c to the coremap is atomic. It also
+ * protects every page table entry that maps a resident user page
+ * while the page is not pinned.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/* Threads waiting for a busy page sleep here. */
+static struct wchan *coremap_wchan;
+
+/* Largest value that fits in cme_refcount. */
+#define CM_MAXREFS  ((1U << 12) - 1)
+
+/* The pageout low-water mark is this fraction of memory. */
+#define COREMAP_LOWATER_DIV  32
+
+static struct coremap_entry *coremap;
+static unsigned coremap_npages;		/* number of entries */
+static unsigned coremap_nused;		/* entries not CM_FREE */
+static unsigned coremap_hint;		/* next place to look */
+static unsigned coremap_clockhand;	/* next eviction candidate */
+static bool coremap_ready;
+
+/* The pageout daemon sleeps here; NULL if it isn't running. */
+static struct wchan *coremap_pageoutwchan;
+static unsigned coremap_lowater;	/* wake the daemon below this */
+static unsigned coremap_hiwater;	/* and let it sleep above this */
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t cmpaddr, firstpaddr;
+	size_t cmpages;
+	unsigned i, nfixed;
+
+	spinlock_acquire(&coremap_lock);
+
+	KASSERT(coremap_ready == false);
+
+	coremap_npages = ram_getsize() / PAGE_SIZE;
+	cmpages = DIVROUNDUP(coremap_npages * sizeof(struct coremap_entry),
+			     PAGE_SIZE);
+	cmpaddr = ram_stealmem(cmpages);
+	if (cmpaddr == 0) {
+		panic("coremap: cannot allocate %u pages for coremap\n",
+		      (unsigned)cmpages);
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	/* Everything below this is already in use and stays that way. */
+	firstpaddr = ram_getfirstfree();
+	nfixed = firstpaddr / PAGE_SIZE;
+	KASSERT(nfixed < coremap_npages);
+
+	for (i=0; i<coremap_npages; i++) {
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_state = (i < nfixed) ? CM_FIXED : CM_FREE;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_referenced = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_npages = (i < nfixed) ? 1 : 0;
+		coremap[i].cme_clean = 0;
+		coremap[i].cme_slot = 0;
+	}
+	coremap_nused = nfixed;
+	coremap_hint = nfixed;
+	coremap_clockhand = nfixed;
+	coremap_ready = true;
+
+	spinlock_release(&coremap_lock);
+
+	coremap_wchan = wchan_create("coremap");
+	if (coremap_wchan == NULL) {
+		panic("coremap: cannot create wait channel\n");
+	}
+
+	kprintf("coremap: %u pages, %u in use by kernel\n",
+		coremap_npages, nfixed);
+}
+
+/*
+ * Find NPAGES contiguous free pages, searching from the hint and
+ * wrapping around once. Returns the index of the first page, or
+ * coremap_npages if there is no such run.
+ */
+static
+unsigned
+coremap_findrun(unsigned npages)
+{
+	unsigned start, run, i, scanned;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (npages == 0 || npages > coremap_npages - coremap_nused) {
+		return coremap_npages;
+	}
+
+	start = coremap_hint;
+	run = 0;
+	i = start;
+	for (scanned = 0; scanned < coremap_npages; scanned++, i++) {
+		if (i == coremap_npages) {
+			/* Runs cannot wrap past the end of memory. */
+			i = 0;
+			run = 0;
+		}
+		if (coremap[i].cme_state != CM_FREE) {
+			run = 0;
+			continue;
+		}
+		if (run == 0) {
+			start = i;
+		}
+		run++;
+		if (run == npages) {
+			return start;
+		}
+	}
+	return coremap_npages;
+}
+
+/*
+ * Set up NPAGES pages starting at index START as allocated in STATE.
+ * User pages start out pinned.
+ */
+static
+void
+coremap_take(unsigned start, unsigned npages, unsigned state,
+	     struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i=start; i<start+npages; i++) {
+		coremap[i].cme_state = state;
+		coremap[i].cme_as = as;
+		coremap[i].cme_vaddr = vaddr;
+		coremap[i].cme_busy = (state == CM_USER);
+		coremap[i].cme_referenced = 1;
+		coremap[i].cme_refcount = 1;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_clean = 0;
+		coremap[i].cme_slot = 0;
+	}
+	coremap[start].cme_npages = npages;
+}
+
+/*
+ * Wake the pageout daemon if free memory is getting low.
+ */
+static
+void
+coremap_checkwater(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (coremap_pageoutwchan != NULL &&
+	    coremap_npages - coremap_nused < coremap_lowater) {
+		wchan_wakeone(coremap_pageoutwchan, &coremap_lock);
+	}
+}
+
+/*
+ * Check whether we can page something out right now: there must be
+ * swap, and we must be able to sleep. The only spinlock held should
+ * be the coremap lock itself, which coremap_pageout releases.
+ */
+static
+bool
+coremap_canevict(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (!swap_enabled() || !CURCPU_EXISTS()) {
+		return false;
+	}
+	return curthread->t_in_interrupt == false &&
+		curcpu->c_spinlocks == 1;
+}
+
+/*
+ * Clear the referenced bit of user page CME. Since the TLB refill
+ * code can't set it again, mark the page table entry PTE_NOREF so
+ * the next use goes through vm_fault, which does, and add the page
+ * to TB to knock it out of the TLBs. If TB is full, any TLB entries
+ * for the page are left to be replaced in the normal course of
+ * things. The page must not be pinned.
+ */
+static
+void
+coremap_unreference(struct coremap_entry *cme, struct tlbbatch *tb)
+{
+	pte_t *pte;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(!cme->cme_busy);
+
+	cme->cme_referenced = 0;
+	pte = pt_lookup(cme->cme_as->as_pt, cme->cme_vaddr, false);
+	KASSERT(pte != NULL);
+	*pte |= PTE_NOREF;
+	if (tb->tb_nranges < TLBBATCH_MAX) {
+		vm_tlbbatch_add(tb, cme->cme_as, cme->cme_vaddr, 1);
+	}
+}
+
+/*
+ * Run the clock: advance the hand over the coremap looking for a
+ * user page that has a single owner, is not pinned, and has not been
+ * referenced since the hand last passed it. Referenced pages have
+ * their bit cleared and get a second chance; the TLB entries to
+ * flush for them are added to TB. Returns the index, or
+ * coremap_npages if two full sweeps found nothing.
+ *
+ * A page that was shared and is down to one reference again has lost
+ * track of its owner; look it up, so it can be evicted like any other.
+ */
+static
+unsigned
+coremap_clock(struct tlbbatch *tb)
+{
+	struct coremap_entry *cme;
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (n = 0; n < 2 * coremap_npages; n++) {
+		i = coremap_clockhand;
+		coremap_clockhand = (i + 1) % coremap_npages;
+
+		cme = &coremap[i];
+		if (cme->cme_state != CM_USER || cme->cme_busy ||
+		    cme->cme_refcount != 1) {
+			continue;
+		}
+		if (cme->cme_as == NULL) {
+			cme->cme_as = as_findmapping((paddr_t)i * PAGE_SIZE,
+						     cme->cme_vaddr);
+			if (cme->cme_as == NULL) {
+				continue;
+			}
+		}
+		if (cme->cme_referenced) {
+			coremap_unreference(cme, tb);
+			continue;
+		}
+		return i;
+	}
+	return coremap_npages;
+}
+
+/*
+ * A page chosen for eviction, and what we need to know about it
+ * once the coremap lock is released.
+ */
+struct coremap_victim {
+	unsigned cv_index;		/* coremap index */
+	struct addrspace *cv_as;	/* owner */
+	vaddr_t cv_vaddr;		/* where the owner maps it */
+	pte_t *cv_pte;			/* the owner's page table entry */
+	pte_t cv_oldpte;		/* what it said before pageout */
+	unsigned cv_slot;		/* swap slot it goes to */
+	bool cv_clean;			/* already in cv_slot */
+	int cv_result;			/* outcome of writing it out */
+};
+
+/*
+ * Write the dirty victims in V out to swap, as a single transfer to
+ * consecutive slots if possible, and page by page otherwise.
+ */
+static
+void
+coremap_writeout(struct coremap_victim *v, unsigned nv)
+{
+	paddr_t pas[SWAP_MAXBATCH];
+	unsigned i, n, slot;
+	int result;
+
+	KASSERT(nv <= SWAP_MAXBATCH);
+
+	n = 0;
+	for (i=0; i<nv; i++) {
+		if (!v[i].cv_clean) {
+			pas[n++] = (paddr_t)v[i].cv_index * PAGE_SIZE;
+		}
+	}
+	if (n == 0) {
+		return;
+	}
+
+	if (n > 1 && swap_allocrun(n, &slot) == 0) {
+		result = swap_pageoutv(pas, n, slot);
+		if (result) {
+			for (i=0; i<n; i++) {
+				swap_free(slot + i);
+			}
+		}
+		for (i=0; i<nv; i++) {
+			if (!v[i].cv_clean) {
+				v[i].cv_slot = slot++;
+				v[i].cv_result = result;
+			}
+		}
+		return;
+	}
+
+	for (i=0; i<nv; i++) {
+		if (v[i].cv_clean) {
+			continue;
+		}
+		result = swap_alloc(&v[i].cv_slot);
+		if (result == 0) {
+			result = swap_pageout((paddr_t)v[i].cv_index *
+					      PAGE_SIZE, v[i].cv_slot);
+			if (result) {
+				swap_free(v[i].cv_slot);
+			}
+		}
+		v[i].cv_result = result;
+	}
+}
+
+/*
+ * Evict up to MAX pages. Called with the coremap lock held; the lock
+ * is dropped while pages are written out and held again on return.
+ * Returns the number of pages freed.
+ */
+static
+unsigned
+coremap_pageout(unsigned max)
+{
+	struct coremap_victim v[SWAP_MAXBATCH];
+	struct coremap_entry *cme;
+	struct tlbbatch tb;
+	unsigned i, nv, nfreed;
+	paddr_t pa;
+	pte_t *pte;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(max <= SWAP_MAXBATCH);
+
+	/*
+	 * Pin the victims; from here on their owners cannot use them
+	 * or change their mappings, and cannot destroy their address
+	 * spaces. Also mark them in transit, so the TLB refill code
+	 * (which doesn't look at pins) can't load them again.
+	 */
+	vm_tlbbatch_init(&tb);
+	for (nv = 0; nv < max; nv++) {
+		i = coremap_clock(&tb);
+		if (i == coremap_npages) {
+			break;
+		}
+		cme = &coremap[i];
+		pa = (paddr_t)i * PAGE_SIZE;
+		pte = pt_lookup(cme->cme_as->as_pt, cme->cme_vaddr, false);
+		KASSERT(pte != NULL);
+		KASSERT((*pte & (PTE_FRAME | PTE_VALID)) == (pa | PTE_VALID));
+
+		cme->cme_busy = 1;
+		v[nv].cv_index = i;
+		v[nv].cv_as = cme->cme_as;
+		v[nv].cv_vaddr = cme->cme_vaddr;
+		v[nv].cv_pte = pte;
+		v[nv].cv_oldpte = *pte;
+		v[nv].cv_clean = cme->cme_clean;
+		v[nv].cv_slot = cme->cme_slot;
+		v[nv].cv_result = 0;
+		*pte = pa | PTE_INTRANSIT;
+	}
+	if (nv == 0) {
+		/* Still flush whatever the clock unreferenced. */
+		if (tb.tb_nranges > 0) {
+			spinlock_release(&coremap_lock);
+			vm_tlbbatch_flush(&tb);
+			spinlock_acquire(&coremap_lock);
+		}
+		return 0;
+	}
+	spinlock_release(&coremap_lock);
+
+	/* Stop further writes through any TLB before copying them out. */
+	for (i=0; i<nv; i++) {
+		vm_tlbbatch_add(&tb, v[i].cv_as, v[i].cv_vaddr, 1);
+	}
+	vm_tlbbatch_flush(&tb);
+
+	coremap_writeout(v, nv);
+
+	spinlock_acquire(&coremap_lock);
+
+	nfreed = 0;
+	for (i=0; i<nv; i++) {
+		cme = &coremap[v[i].cv_index];
+		pa = (paddr_t)v[i].cv_index * PAGE_SIZE;
+
+		if (v[i].cv_result) {
+			kprintf("coremap: pageout of 0x%x failed: %s\n", pa,
+				strerror(v[i].cv_result));
+			*v[i].cv_pte = v[i].cv_oldpte;
+			cme->cme_busy = 0;
+			continue;
+		}
+
+		KASSERT(*v[i].cv_pte == (pa | PTE_INTRANSIT));
+		*v[i].cv_pte = PTE_MKSWAP(v[i].cv_slot);
+
+		DEBUG(DB_VM, "coremap: evicted 0x%x (vaddr 0x%x) to slot %u\n",
+		      pa, v[i].cv_vaddr, v[i].cv_slot);
+
+		/* The slot belongs to the page table entry now. */
+		cme->cme_state = CM_FREE;
+		cme->cme_as = NULL;
+		cme->cme_vaddr = 0;
+		cme->cme_busy = 0;
+		cme->cme_referenced = 0;
+		cme->cme_refcount = 0;
+		cme->cme_clean = 0;
+		cme->cme_slot = 0;
+		coremap_nused--;
+		nfreed++;
+	}
+
+	/* Owners may be waiting in coremap_pin to find them gone. */
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+
+	return nfreed;
+}
+
+/*
+ * The pageout daemon. Sleeps until the number of free pages drops
+ * below the low-water mark, then evicts pages a batch at a time
+ * until it is back above the high-water mark or nothing more can
+ * be evicted.
+ */
+static
+void
+coremap_pageoutd(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		wchan_sleep(coremap_pageoutwchan, &coremap_lock);
+		while (coremap_npages - coremap_nused < coremap_hiwater) {
+			if (coremap_pageout(SWAP_MAXBATCH) == 0) {
+				break;
+			}
+		}
+	}
+}
+
+void
+coremap_startpageout(void)
+{
+	int result;
+
+	if (!swap_enabled()) {
+		return;
+	}
+
+	coremap_lowater = coremap_npages / COREMAP_LOWATER_DIV;
+	if (coremap_lowater < SWAP_MAXBATCH) {
+		coremap_lowater = SWAP_MAXBATCH;
+	}
+	coremap_hiwater = 2 * coremap_lowater;
+
+	coremap_pageoutwchan = wchan_create("pageout");
+	if (coremap_pageoutwchan == NULL) {
+		panic("coremap: cannot create pageout wait channel\n");
+	}
+	result = thread_fork("pageout", NULL, coremap_pageoutd, NULL, 0);
+	if (result) {
+		panic("coremap: cannot start pageout daemon: %s\n",
+		      strerror(result));
+	}
+
+	kprintf("coremap: pageout daemon keeps %u-%u pages free\n",
+		coremap_lowater, coremap_hiwater);
+}
+
+/*
+ * Get one page for STATE, evicting something if necessary and
+ * possible. Called and returns with the coremap lock held.
+ */
+static
+unsigned
+coremap_getpage(unsigned state, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned index;
+
+	index = coremap_findrun(1);
+	while (index == coremap_npages && coremap_canevict() &&
+	       coremap_pageout(1) > 0) {
+		/* Someone else may have taken it; if so, go again. */
+		index = coremap_findrun(1);
+	}
+	if (index == coremap_npages) {
+		return coremap_npages;
+	}
+	coremap_take(index, 1, state, as, vaddr);
+	coremap_nused++;
+	coremap_hint = (index + 1) % coremap_npages;
+	coremap_checkwater();
+	return index;
+}
+
+paddr_t
+coremap_alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+	unsigned start;
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_ready) {
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	if (npages == 1) {
+		start = coremap_getpage(CM_KERNEL, NULL, 0);
+	}
+	else {
+		/* No attempt is made to evict a contiguous run. */
+		start = coremap_findrun(npages);
+		if (start != coremap_npages) {
+			coremap_take(start, npages, CM_KERNEL, NULL, 0);
+			coremap_nused += npages;
+			coremap_hint = (start + npages) % coremap_npages;
+			coremap_checkwater();
+		}
+	}
+	spinlock_release(&coremap_lock);
+
+	if (start == coremap_npages) {
+		return 0;
+	}
+	return (paddr_t)start * PAGE_SIZE;
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr, bool zero)
+{
+	paddr_t pa;
+	unsigned index;
+
+	KASSERT(as != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_ready);
+	index = coremap_getpage(CM_USER, as, vaddr);
+	spinlock_release(&coremap_lock);
+
+	if (index == coremap_npages) {
+		return 0;
+	}
+
+	/* Unless the caller is about to overwrite it, scrub old data. */
+	pa = (paddr_t)index * PAGE_SIZE;
+	if (zero) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	unsigned index, npages, i;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	index = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_ready);
+	KASSERT(index < coremap_npages);
+
+	cme = &coremap[index];
+	switch (cme->cme_state) {
+	    case CM_FIXED:
+		/* We don't know how big early allocations were; leak. */
+		spinlock_release(&coremap_lock);
+		return;
+	    case CM_KERNEL:
+		npages = cme->cme_npages;
+		KASSERT(npages > 0);
+		break;
+	    case CM_USER:
+		KASSERT(cme->cme_busy);
+		KASSERT(cme->cme_refcount > 0);
+		cme->cme_busy = 0;
+		wchan_wakeall(coremap_wchan, &coremap_lock);
+		if (--cme->cme_refcount > 0) {
+			/* Still mapped copy-on-write elsewhere. */
+			spinlock_release(&coremap_lock);
+			return;
+		}
+		if (cme->cme_clean) {
+			swap_free(cme->cme_slot);
+		}
+		npages = 1;
+		break;
+	    default:
+		panic("coremap_free: page 0x%x is not allocated\n", paddr);
+	}
+
+	KASSERT(index + npages <= coremap_npages);
+	for (i=index; i<index+npages; i++) {
+		coremap[i].cme_state = CM_FREE;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_referenced = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_clean = 0;
+		coremap[i].cme_slot = 0;
+	}
+	KASSERT(coremap_nused >= npages);
+	coremap_nused -= npages;
+
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_pin(pte_t *pte)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	while (*pte & (PTE_VALID | PTE_INTRANSIT)) {
+		cme = &coremap[(*pte & PTE_FRAME) / PAGE_SIZE];
+		KASSERT(cme->cme_state == CM_USER);
+		if (!cme->cme_busy) {
+			KASSERT(*pte & PTE_VALID);
+			cme->cme_busy = 1;
+			spinlock_release(&coremap_lock);
+			return true;
+		}
+		/* Being paged out, or used by someone else; recheck. */
+		wchan_sleep(coremap_wchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+	return false;
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(paddr / PAGE_SIZE < coremap_npages);
+	cme = &coremap[paddr / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = 0;
+	cme->cme_referenced = 1;
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_share(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(paddr / PAGE_SIZE < coremap_npages);
+	cme = &coremap[paddr / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	KASSERT(cme->cme_busy);
+	KASSERT(cme->cme_refcount > 0);
+	if (cme->cme_refcount == CM_MAXREFS) {
+		panic("coremap: too many references to page 0x%x\n", paddr);
+	}
+	cme->cme_refcount++;
+	/* Every sharer maps it at the same cme_vaddr, as fork copies. */
+	cme->cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_claim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	bool sole;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(paddr / PAGE_SIZE < coremap_npages);
+	cme = &coremap[paddr / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	KASSERT(cme->cme_busy);
+	KASSERT(cme->cme_refcount > 0);
+	sole = (cme->cme_refcount == 1);
+	if (sole) {
+		cme->cme_as = as;
+		cme->cme_vaddr = vaddr;
+		if (cme->cme_clean) {
+			/* About to be written; the swap copy is stale. */
+			swap_free(cme->cme_slot);
+			cme->cme_clean = 0;
+			cme->cme_slot = 0;
+		}
+	}
+	spinlock_release(&coremap_lock);
+
+	return sole;
+}
+
+void
+coremap_setclean(paddr_t paddr, unsigned slot)
+{
+	struct coremap_entry *cme;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(slot < SWAP_MAXSLOTS);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(paddr / PAGE_SIZE < coremap_npages);
+	cme = &coremap[paddr / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	KASSERT(cme->cme_busy);
+	KASSERT(!cme->cme_clean);
+	cme->cme_clean = 1;
+	cme->cme_slot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+int
+coremap_used_bytes(void)
+{
+	unsigned bytes;
+
+	spinlock_acquire(&coremap_lock);
+	bytes = coremap_ready ? coremap_nused * PAGE_SIZE : 0;
+	spinlock_release(&coremap_lock);
+
+	return bytes;
+}
@@ -30,9 +30,14 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <kmemcache.h>
 #include <kern/test161.h>
 #include <test.h>
+#include "opt-dumbvm.h"
 
 /*
  * Kernel malloc.
@@ -113,6 +118,9 @@ fill_deadbeef(void *vptr, size_t len)
  * CHECKGUARDS checks that allocated blocks' guard bands are intact
  * when checking kernel heap pages with SLOW and SLOWER. This is also
  * quite slow in its own right.
+ *
+ * Per-cpu magazines (see below) are used unless GUARDS or LABELS is
+ * enabled, as those need to see every allocation and free.
  */
 
 #undef  SLOW
@@ -123,6 +131,10 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+#if !defined(GUARDS) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
@@ -162,14 +174,27 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole thing. In front of it sit per-cpu
+ * magazines of free blocks (see below), so that most allocations and
+ * frees never take it.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Counts of allocations by the way they were satisfied, for
+ * kheap_printstats. Protected by kmalloc_spinlock. (Allocations
+ * served from magazines are counted in the magazines.)
+ */
+static struct {
+	unsigned long ks_subpage;	/* subpage blocks from the heap */
+	unsigned long ks_onepage;	/* single pages */
+	unsigned long ks_kv;		/* multi-page, mapped in kseg2 */
+	unsigned long ks_kvpages;	/* ...and pages in them */
+	unsigned long ks_contig;	/* multi-page, physically contiguous */
+	unsigned long ks_contigpages;	/* ...and pages in them */
+} kmalloc_stats;
+
 ////////////////////////////////////////
 
 /*
@@ -347,6 +372,37 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * Heap pages are also entered in a direct-mapped table indexed by
+ * page number, so the pageref for a block can usually be found
+ * without walking allbase, and without the lock. Since the heap can't
+ * be more than TOTAL_PAGEREFS pages, collisions only happen if the
+ * kernel's pages are scattered over more address space than that;
+ * pages that collide are just not entered.
+ *
+ * Entries are only changed with the lock held, and the entry for a
+ * page can't change while any block on it is allocated.
+ */
+static struct pageref *pagemap[TOTAL_PAGEREFS];
+
+#define PAGEMAP_SLOT(va)  (((va) / PAGE_SIZE) % TOTAL_PAGEREFS)
+
+/*
+ * Find the pageref for the heap page PTRADDR is on, or return NULL.
+ */
+static
+struct pageref *
+pagemap_lookup(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+
+	pr = pagemap[PAGEMAP_SLOT(ptraddr)];
+	if (pr != NULL && PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME)) {
+		return pr;
+	}
+	return NULL;
+}
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -799,6 +855,11 @@ subpage_stats(struct pageref *pr, bool quiet)
 	return ((unsigned long)sizes[blktype] * (n - (unsigned) pr->nfree));
 }
 
+#ifdef MAGAZINES
+static unsigned long magazine_bytes(void);
+static unsigned long magazine_hits(void);
+#endif
+
 /*
  * Print the whole heap.
  */
@@ -815,6 +876,22 @@ kheap_printstats(void)
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		subpage_stats(pr, false);
 	}
+#ifdef MAGAZINES
+	kprintf("%lu bytes cached in per-cpu magazines\n", magazine_bytes());
+#endif
+
+	kprintf("Allocations by path:\n");
+#ifdef MAGAZINES
+	kprintf("    subpage, per-cpu magazine:  %lu\n", magazine_hits());
+#endif
+	kprintf("    subpage, shared heap:       %lu\n",
+		kmalloc_stats.ks_subpage);
+	kprintf("    single page:                %lu\n",
+		kmalloc_stats.ks_onepage);
+	kprintf("    multi-page, kseg2 mapped:   %lu (%lu pages)\n",
+		kmalloc_stats.ks_kv, kmalloc_stats.ks_kvpages);
+	kprintf("    multi-page, contiguous:     %lu (%lu pages)\n",
+		kmalloc_stats.ks_contig, kmalloc_stats.ks_contigpages);
 
 	spinlock_release(&kmalloc_spinlock);
 }
@@ -830,6 +907,12 @@ kheap_getused(void) {
 	unsigned long total = 0;
 	unsigned int num_pages = 0, coremap_bytes = 0;
 
+	/*
+	 * Objects sitting in object caches aren't in use either, but
+	 * we can't tell how much memory they hang on to; release them.
+	 */
+	kmem_cache_reapall();
+
 	/* compute with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
@@ -837,6 +920,11 @@ kheap_getused(void) {
 		num_pages++;
 	}
 
+#ifdef MAGAZINES
+	/* Blocks sitting in magazines aren't in use. */
+	total -= magazine_bytes();
+#endif
+
 	coremap_bytes = coremap_used_bytes();
 
 	// Don't double-count the pages we're using for subpage allocation;
@@ -914,6 +1002,42 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Take a block off the free list of PR, which must have one. Called
+ * with the lock held.
+ */
+static
+void *
+subpage_popblock(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return retptr;
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -959,6 +1083,8 @@ subpage_kmalloc(size_t sz
 
 	checksubpages();
 
+	kmalloc_stats.ks_subpage++;
+
 	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
 
 		/* check for corruption */
@@ -969,25 +1095,7 @@ subpage_kmalloc(size_t sz
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_popblock(pr);
 #ifdef GUARDS
 			retptr = establishguardband(retptr, clientsz, sz);
 #endif
@@ -1061,10 +1169,76 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	if (pagemap[PAGEMAP_SLOT(prpage)] == NULL) {
+		pagemap[PAGEMAP_SLOT(prpage)] = pr;
+	}
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
+/*
+ * Put the block at PTRADDR back on the free list of PR, the page it
+ * is on. Called with the lock held. If the whole page is now free,
+ * it is taken out of the heap and its address returned, for the
+ * caller to free_kpages once it has released the lock; otherwise
+ * returns 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+	KASSERT(offset < PAGE_SIZE && offset % sizes[blktype] == 0);
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fl = (struct freelist *)ptraddr;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		remove_lists(pr, blktype);
+		if (pagemap[PAGEMAP_SLOT(prpage)] == pr) {
+			pagemap[PAGEMAP_SLOT(prpage)] = NULL;
+		}
+		freepageref(pr);
+		return prpage;
+	}
+	return 0;
+}
+
 /*
  * Free a pointer previously returned from subpage_kmalloc. If the
  * pointer is not on any heap page we recognize, return -1.
@@ -1077,8 +1251,6 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
@@ -1117,17 +1289,14 @@ subpage_kfree(void *ptr)
 	prpage = 0;
 	blktype = 0;
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+	pr = pagemap_lookup(ptraddr);
+	if (pr == NULL) {
+		/* Not in the page map; look the long way. */
+		for (pr = allbase; pr; pr = pr->next_all) {
+			prpage = PR_PAGEADDR(pr);
+			if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+				break;
+			}
 		}
 	}
 
@@ -1137,6 +1306,13 @@ subpage_kfree(void *ptr)
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1156,57 +1332,240 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
+	prpage = subpage_putblock(pr, ptraddr);
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
+		free_kpages(prpage);
+	}
 
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
 
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+//    Each cpu keeps, for each block size, a small stack (magazine) of
+//    free blocks taken from the subpage allocator. kmalloc and kfree
+//    use the current cpu's magazine with interrupts off and no lock.
+//    When a magazine runs dry it is refilled with half a magazine's
+//    worth of blocks in one trip to the subpage allocator, and when
+//    one overflows half of it is given back the same way.
+//
+//    Blocks in magazines count as allocated as far as the subpage
+//    allocator is concerned, so a page with blocks in a magazine is
+//    never released; magazines are kept small (especially for the
+//    larger sizes) to limit the memory tied up this way.
+
+#ifdef MAGAZINES
+
+#define MAXMAGSIZE 16
+static const unsigned magsizes[NSIZES] = { 16, 16, 16, 8, 4, 2, 2, 2 };
+
+struct magazine {
+	unsigned count;
+	void *blocks[MAXMAGSIZE];
+};
+
+struct kmalloc_cpucache {
+	struct magazine mags[NSIZES];
+	unsigned long hits;		/* allocations served */
+	struct kmalloc_cpucache *next;	/* on allcaches, for stats */
+};
+
+/* All the cpu caches. Protected by kmalloc_spinlock. */
+static struct kmalloc_cpucache *allcaches;
+
+struct kmalloc_cpucache *
+kmalloc_cpucache_create(void)
+{
+	struct kmalloc_cpucache *kc;
+	unsigned i;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	for (i=0; i<NSIZES; i++) {
+		KASSERT(magsizes[i] <= MAXMAGSIZE);
+		kc->mags[i].count = 0;
+	}
+	kc->hits = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	kc->next = allcaches;
+	allcaches = kc;
+	spinlock_release(&kmalloc_spinlock);
+
+	return kc;
+}
+
+/*
+ * Return the bytes sitting in magazines. Called with the lock held.
+ * Other cpus' magazines may be changing, so this is approximate.
+ */
+static
+unsigned long
+magazine_bytes(void)
+{
+	struct kmalloc_cpucache *kc;
+	unsigned long total;
+	unsigned i;
+
+	total = 0;
+	for (kc = allcaches; kc != NULL; kc = kc->next) {
+		for (i=0; i<NSIZES; i++) {
+			total += kc->mags[i].count * sizes[i];
 		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+	return total;
+}
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+/*
+ * Return the number of allocations served from magazines. Called
+ * with the lock held; approximate, like magazine_bytes.
+ */
+static
+unsigned long
+magazine_hits(void)
+{
+	struct kmalloc_cpucache *kc;
+	unsigned long total;
+
+	total = 0;
+	for (kc = allcaches; kc != NULL; kc = kc->next) {
+		total += kc->hits;
 	}
-	else {
+	return total;
+}
+
+/*
+ * Get a block of type BLKTYPE from the current cpu's magazine,
+ * refilling it from existing heap pages if it's empty. Returns NULL
+ * if there are none, in which case the caller should go to the
+ * subpage allocator, which can get a new page.
+ */
+static
+void *
+magazine_alloc(unsigned blktype)
+{
+	struct magazine *mag;
+	struct pageref *pr;
+	void *ret;
+	int spl;
+
+	/* Interrupts off, so we stay on this cpu. */
+	spl = splhigh();
+	if (!CURCPU_EXISTS() || curcpu->c_kmcache == NULL) {
+		splx(spl);
+		return NULL;
+	}
+	mag = &curcpu->c_kmcache->mags[blktype];
+
+	if (mag->count == 0) {
+		spinlock_acquire(&kmalloc_spinlock);
+		checksubpages();
+		for (pr = sizebases[blktype];
+		     pr != NULL && mag->count < magsizes[blktype] / 2;
+		     pr = pr->next_samesize) {
+			KASSERT(PR_BLOCKTYPE(pr) == blktype);
+			/* magazine_free needs to find the page again */
+			if (pagemap_lookup(PR_PAGEADDR(pr)) != pr) {
+				continue;
+			}
+			while (pr->nfree > 0 &&
+			       mag->count < magsizes[blktype] / 2) {
+				mag->blocks[mag->count++] =
+					subpage_popblock(pr);
+			}
+		}
 		spinlock_release(&kmalloc_spinlock);
 	}
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	ret = NULL;
+	if (mag->count > 0) {
+		ret = mag->blocks[--mag->count];
+		curcpu->c_kmcache->hits++;
+	}
+	splx(spl);
+	return ret;
+}
+
+/*
+ * Put the block PTR, of type BLKTYPE, in the current cpu's magazine,
+ * sending half the magazine back to the heap first if it's full.
+ * Returns false if there is no magazine to put it in.
+ */
+static
+bool
+magazine_free(void *ptr, unsigned blktype)
+{
+	struct magazine *mag;
+	void *drain[MAXMAGSIZE];
+	vaddr_t freepages[MAXMAGSIZE];
+	unsigned i, ndrain, nfreepages;
+	int spl;
+
+	spl = splhigh();
+	if (!CURCPU_EXISTS() || curcpu->c_kmcache == NULL) {
+		splx(spl);
+		return false;
+	}
+	mag = &curcpu->c_kmcache->mags[blktype];
+
+	ndrain = 0;
+	if (mag->count == magsizes[blktype]) {
+		ndrain = (magsizes[blktype] + 1) / 2;
+		mag->count -= ndrain;
+		for (i=0; i<ndrain; i++) {
+			drain[i] = mag->blocks[mag->count + i];
+		}
+	}
+	mag->blocks[mag->count++] = ptr;
+	splx(spl);
+
+	if (ndrain == 0) {
+		return true;
+	}
+
+	nfreepages = 0;
 	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<ndrain; i++) {
+		freepages[nfreepages] = subpage_putblock(
+			pagemap_lookup((vaddr_t)drain[i]), (vaddr_t)drain[i]);
+		if (freepages[nfreepages] != 0) {
+			nfreepages++;
+		}
+	}
 	checksubpages();
 	spinlock_release(&kmalloc_spinlock);
-#endif
 
-	return 0;
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+	return true;
 }
 
+#else /* not MAGAZINES */
+
+struct kmalloc_cpucache *
+kmalloc_cpucache_create(void)
+{
+	return NULL;
+}
+
+#endif /* MAGAZINES */
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -1234,21 +1593,61 @@ kmalloc(size_t sz)
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
+		bool kv;
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
+
+		/*
+		 * Map multi-page requests into kernel virtual space
+		 * if we can, so they don't need contiguous memory.
+		 */
+		kv = false;
+		address = 0;
+#if !OPT_DUMBVM
+		if (npages > 1) {
+			address = alloc_kvpages(npages);
+			kv = (address != 0);
+		}
+#endif
+		if (address == 0) {
+			address = alloc_kpages(npages);
+		}
 		if (address==0) {
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
+		spinlock_acquire(&kmalloc_spinlock);
+		if (npages == 1) {
+			kmalloc_stats.ks_onepage++;
+		}
+		else if (kv) {
+			kmalloc_stats.ks_kv++;
+			kmalloc_stats.ks_kvpages += npages;
+		}
+		else {
+			kmalloc_stats.ks_contig++;
+			kmalloc_stats.ks_contigpages += npages;
+		}
+		spinlock_release(&kmalloc_spinlock);
+
 		return (void *)address;
 	}
 
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
+#ifdef MAGAZINES
+	{
+		void *ptr;
+
+		ptr = magazine_alloc(blocktype(sz));
+		if (ptr != NULL) {
+			return ptr;
+		}
+	}
+#endif
 	return subpage_kmalloc(sz);
 #endif
 }
@@ -1262,9 +1661,29 @@ kfree(void *ptr)
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
+#ifdef MAGAZINES
+	struct pageref *pr;
+#endif
+
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#ifdef MAGAZINES
+	/*
+	 * If the page map knows the page it's a subpage block; put it
+	 * in a magazine.
+	 */
+	pr = pagemap_lookup((vaddr_t)ptr);
+	if (pr != NULL) {
+		KASSERT(((vaddr_t)ptr - PR_PAGEADDR(pr)) %
+			sizes[PR_BLOCKTYPE(pr)] == 0);
+		fill_deadbeef(ptr, sizes[PR_BLOCKTYPE(pr)]);
+		if (magazine_free(ptr, PR_BLOCKTYPE(pr))) {
+			return;
+		}
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
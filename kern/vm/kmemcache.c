@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Object caches. See kmemcache.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmemcache.h>
+
+/*
+ * Caches that have ever held free objects, for kmem_cache_reapall.
+ * Caches get on the list the first time an object is freed to them,
+ * since statically initialized caches have no other chance to.
+ */
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+/*
+ * Set up a cache.
+ */
+void
+kmem_cache_init(struct kmem_cache *kc, const char *name, size_t size,
+		int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	KASSERT(size > 0);
+
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_nfree = 0;
+	kc->kc_listed = false;
+	kc->kc_next = NULL;
+}
+
+/*
+ * Tear down a cache. Nobody else may be using it.
+ */
+void
+kmem_cache_cleanup(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+
+	kmem_cache_reap(kc);
+	KASSERT(kc->kc_nfree == 0);
+
+	spinlock_acquire(&kmem_caches_lock);
+	if (kc->kc_listed) {
+		for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+			KASSERT(*kcp != NULL);
+		}
+		*kcp = kc->kc_next;
+		kc->kc_listed = false;
+	}
+	spinlock_release(&kmem_caches_lock);
+
+	spinlock_cleanup(&kc->kc_lock);
+}
+
+/*
+ * Create a cache.
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kmem_cache_init(kc, name, size, ctor, dtor);
+	return kc;
+}
+
+/*
+ * Destroy a cache.
+ */
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	kmem_cache_cleanup(kc);
+	kfree(kc);
+}
+
+/*
+ * Get an object: a cached one if there is one, otherwise a new one.
+ */
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	obj = NULL;
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nfree > 0) {
+		obj = kc->kc_free[--kc->kc_nfree];
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (obj != NULL) {
+		return obj;
+	}
+
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+		kfree(obj);
+		return NULL;
+	}
+	return obj;
+}
+
+/*
+ * Destroy an object for real.
+ */
+static
+void
+kmem_cache_release(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+/*
+ * Return an object to the cache, or destroy it if the cache is full.
+ */
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	bool cached;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	if (!kc->kc_listed) {
+		spinlock_acquire(&kmem_caches_lock);
+		if (!kc->kc_listed) {
+			kc->kc_next = kmem_caches;
+			kmem_caches = kc;
+			kc->kc_listed = true;
+		}
+		spinlock_release(&kmem_caches_lock);
+	}
+
+	cached = false;
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nfree < KMEM_CACHE_DEPTH) {
+		kc->kc_free[kc->kc_nfree++] = obj;
+		cached = true;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (!cached) {
+		kmem_cache_release(kc, obj);
+	}
+}
+
+/*
+ * Destroy all the objects in a cache.
+ */
+void
+kmem_cache_reap(struct kmem_cache *kc)
+{
+	void *objs[KMEM_CACHE_DEPTH];
+	unsigned i, n;
+
+	/* Take them all at once, and destroy them without the lock. */
+	spinlock_acquire(&kc->kc_lock);
+	n = kc->kc_nfree;
+	for (i=0; i<n; i++) {
+		objs[i] = kc->kc_free[i];
+	}
+	kc->kc_nfree = 0;
+	spinlock_release(&kc->kc_lock);
+
+	for (i=0; i<n; i++) {
+		kmem_cache_release(kc, objs[i]);
+	}
+}
+
+/*
+ * Destroy the objects in all caches. This is for when we want to know
+ * how much memory is really in use; it shouldn't run concurrently with
+ * kmem_cache_cleanup.
+ *
+ * Destructors may free objects to other caches, so the list lock
+ * can't be held while reaping; instead find each cache by position.
+ * For the same reason a destructor can refill a cache this pass has
+ * already reaped, or list a new one at the head where the walk won't
+ * see it, so keep making passes until one finds nothing to reap.
+ */
+void
+kmem_cache_reapall(void)
+{
+	struct kmem_cache *kc;
+	unsigned i, pos, n;
+	bool again;
+
+	do {
+		again = false;
+		for (pos = 0; ; pos++) {
+			spinlock_acquire(&kmem_caches_lock);
+			kc = kmem_caches;
+			for (i=0; i<pos && kc != NULL; i++) kc = kc->kc_next;
+			spinlock_release(&kmem_caches_lock);
+			if (kc == NULL) break;
+
+			spinlock_acquire(&kc->kc_lock);
+			n = kc->kc_nfree;
+			spinlock_release(&kc->kc_lock);
+			if (n > 0) {
+				kmem_cache_reap(kc);
+				again = true;
+			}
+		}
+	} while (again);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Two-level page tables. See <pagetable.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NDIR; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *table;
+
+	for (i=0; i<PT_NDIR; i++) {
+		table = pt->pt_dir[i];
+		if (table == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NENTRIES; j++) {
+			if (coremap_pin(&table[j])) {
+				coremap_free(table[j] & PTE_FRAME);
+			}
+			else if (table[j] & PTE_SWAPPED) {
+				swap_free(PTE_SWAPSLOT(table[j]));
+			}
+		}
+		free_kpages((vaddr_t)table);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	unsigned dirindex;
+	vaddr_t table;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	dirindex = PT_DIRINDEX(vaddr);
+	if (pt->pt_dir[dirindex] == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		table = alloc_kpages(1);
+		if (table == 0) {
+			return NULL;
+		}
+		bzero((void *)table, PAGE_SIZE);
+		pt->pt_dir[dirindex] = (pte_t *)table;
+	}
+	return &pt->pt_dir[dirindex][PT_TABINDEX(vaddr)];
+}
+
+int
+pt_copy(struct pagetable *src, struct pagetable *dst, struct addrspace *newas)
+{
+	unsigned i, j;
+	pte_t *srctable, *dsttable;
+	paddr_t pa;
+	int result;
+
+	for (i=0; i<PT_NDIR; i++) {
+		srctable = src->pt_dir[i];
+		if (srctable == NULL) {
+			continue;
+		}
+		/* Entry 0 of the new table, i.e. the table itself. */
+		dsttable = pt_lookup(dst, i << 22, true);
+		if (dsttable == NULL) {
+			return ENOMEM;
+		}
+		for (j=0; j<PT_NENTRIES; j++) {
+			if (coremap_pin(&srctable[j])) {
+				/*
+				 * Share the page and make both mappings
+				 * read-only; the first write through
+				 * either one copies it.
+				 */
+				pa = srctable[j] & PTE_FRAME;
+				coremap_share(pa);
+				srctable[j] &= ~PTE_WRITE;
+				dsttable[j] = srctable[j];
+				coremap_unpin(pa);
+			}
+			else if (srctable[j] & PTE_SWAPPED) {
+				/*
+				 * Give the child its own copy rather
+				 * than sharing the swap slot. It is
+				 * mapped read-only like any other copy;
+				 * since nobody shares it, the first
+				 * write just turns write access back on.
+				 */
+				pa = coremap_alloc_upage(newas,
+					(i << 22) | (j << 12), false);
+				if (pa == 0) {
+					return ENOMEM;
+				}
+				result = swap_pagein(pa,
+					PTE_SWAPSLOT(srctable[j]));
+				if (result) {
+					coremap_free(pa);
+					return result;
+				}
+				dsttable[j] = pa | PTE_VALID;
+				coremap_unpin(pa);
+			}
+		}
+	}
+	return 0;
+}
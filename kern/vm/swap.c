@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Swap space management. See <swap.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;	/* raw swap device; NULL if none */
+static struct bitmap *swap_map;		/* one bit per slot */
+static unsigned swap_nslots;
+static unsigned swap_nused;
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots > SWAP_MAXSLOTS) {
+		swap_nslots = SWAP_MAXSLOTS;
+	}
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; running without swap\n",
+			SWAP_DEVICE);
+		VOP_DECREF(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: cannot allocate swap map\n");
+	}
+	swap_nused = 0;
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_nused++;
+	}
+	spinlock_release(&swap_lock);
+
+	return result ? ENOSPC : 0;
+}
+
+int
+swap_allocrun(unsigned nslots, unsigned *slot)
+{
+	unsigned i, start, run;
+	int result;
+
+	KASSERT(nslots > 0);
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = ENOSPC;
+	start = run = 0;
+	for (i=0; i<swap_nslots && swap_nused + nslots <= swap_nslots; i++) {
+		if (bitmap_isset(swap_map, i)) {
+			run = 0;
+			continue;
+		}
+		if (run == 0) {
+			start = i;
+		}
+		if (++run == nslots) {
+			for (i=start; i<start+nslots; i++) {
+				bitmap_mark(swap_map, i);
+			}
+			swap_nused += nslots;
+			*slot = start;
+			result = 0;
+			break;
+		}
+	}
+	spinlock_release(&swap_lock);
+
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between PA and SLOT in direction RW.
+ */
+static
+int
+swap_io(paddr_t pa, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+	KASSERT((pa & PAGE_FRAME) == pa);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_pageout(paddr_t pa, unsigned slot)
+{
+	DEBUG(DB_VM, "swap: page 0x%x -> slot %u\n", pa, slot);
+	return swap_io(pa, slot, UIO_WRITE);
+}
+
+int
+swap_pageoutv(const paddr_t *pas, unsigned npages, unsigned slot)
+{
+	struct iovec iov[SWAP_MAXBATCH];
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(npages > 0 && npages <= SWAP_MAXBATCH);
+	KASSERT(slot + npages <= swap_nslots);
+
+	DEBUG(DB_VM, "swap: %u pages -> slots %u-%u\n", npages, slot,
+	      slot + npages - 1);
+
+	for (i=0; i<npages; i++) {
+		KASSERT((pas[i] & PAGE_FRAME) == pas[i]);
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pas[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = npages;
+	ku.uio_offset = (off_t)slot * PAGE_SIZE;
+	ku.uio_resid = npages * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+
+	result = VOP_WRITE(swap_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_pagein(paddr_t pa, unsigned slot)
+{
+	DEBUG(DB_VM, "swap: slot %u -> page 0x%x\n", slot, pa);
+	return swap_io(pa, slot, UIO_READ);
+}
@@ -38,6 +38,7 @@
  * kernel includes. This way user-level code doesn't need to know
  * about the kern/ headers.
  */
+#include <kern/diskstat.h>
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
@@ -147,7 +148,9 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int __diskstat(unsigned unit, struct diskstat *buf);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -158,5 +161,6 @@ ssize_t __getcwd(char *buf, size_t buflen);
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int usleep(unsigned long usecs);		/* calls nanosleep */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * iostat - print disk I/O statistics.
+ * Usage: iostat [-h] [disk...]
+ *
+ * Prints the counters the kernel keeps for each disk (or just the
+ * ones named), and with -h the read and write latency histograms
+ * too.
+ */
+
+static
+void
+printhist(const char *what, const unsigned *hist)
+{
+	unsigned i;
+
+	for (i=0; i<DS_NBUCKETS; i++) {
+		if (hist[i] == 0) {
+			continue;
+		}
+		if (i == DS_NBUCKETS - 1) {
+			printf("    %s %8u+ us: %u\n", what, 1U << i, hist[i]);
+		}
+		else {
+			printf("    %s %8u-%u us: %u\n", what,
+			       i == 0 ? 0 : 1U << i, (2U << i) - 1, hist[i]);
+		}
+	}
+}
+
+static
+void
+printdisk(const struct diskstat *ds, int showhist)
+{
+	printf("%s: %u sectors of %u bytes\n", ds->ds_name,
+	       ds->ds_nsectors, ds->ds_sectsize);
+	printf("    %u reads, %llu sectors, avg %llu us\n",
+	       ds->ds_reads, ds->ds_rsectors,
+	       ds->ds_reads ? ds->ds_rusec / ds->ds_reads : 0);
+	printf("    %u writes, %llu sectors, avg %llu us\n",
+	       ds->ds_writes, ds->ds_wsectors,
+	       ds->ds_writes ? ds->ds_wusec / ds->ds_writes : 0);
+	printf("    %u errors, %u retries, %u in flight (at most %u)\n",
+	       ds->ds_errors, ds->ds_retries, ds->ds_inflight,
+	       ds->ds_maxinflight);
+	if (showhist) {
+		printhist("read ", ds->ds_rhist);
+		printhist("write", ds->ds_whist);
+	}
+}
+
+/*
+ * Is DS one of the disks named on the command line?
+ */
+static
+int
+wanted(const struct diskstat *ds, int argc, char **argv)
+{
+	int i;
+
+	if (argc == 0) {
+		return 1;
+	}
+	for (i=0; i<argc; i++) {
+		if (!strcmp(argv[i], ds->ds_name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct diskstat ds;
+	unsigned unit;
+	int showhist = 0;
+
+	argc--;
+	argv++;
+	if (argc > 0 && !strcmp(argv[0], "-h")) {
+		showhist = 1;
+		argc--;
+		argv++;
+	}
+
+	for (unit = 0; ; unit++) {
+		if (__diskstat(unit, &ds) < 0) {
+			if (errno == ENODEV) {
+				break;
+			}
+			err(1, "__diskstat");
+		}
+		if (wanted(&ds, argc, argv)) {
+			printdisk(&ds, showhist);
+		}
+	}
+	if (unit == 0) {
+		printf("iostat: no disks\n");
+	}
+	return 0;
+}
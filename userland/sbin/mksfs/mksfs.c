@@ -73,6 +73,7 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert((SFS_DIR_MAXBUCKETS & (SFS_DIR_MAXBUCKETS - 1)) == 0);
 }
 
 /*
@@ -165,19 +166,35 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Write out the root directory inode, and its first block. The root
+ * directory starts out indexed, with one empty hash bucket, which goes
+ * in the first block after the freemap.
  */
 static
 void
-writerootdir(void)
+writerootdir(uint32_t fsblocks)
 {
 	struct sfs_dinode sfi;
+	struct sfs_direntry sd[SFS_DIRBUCKET_ENTRIES];
+	uint32_t block;
+
+	block = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+	if (block >= fsblocks) {
+		errx(1, "Filesystem too small -- no room for root directory");
+	}
+	allocblock(block);
+
+	/* Empty entries are all zeros (SFS_NOINO) */
+	bzero((void *)sd, sizeof(sd));
+	diskwrite(sd, block);
 
 	/* Initialize the dinode */
 	bzero((void *)&sfi, sizeof(sfi));
-	sfi.sfi_size = SWAP32(0);
+	sfi.sfi_size = SWAP32(SFS_BLOCKSIZE);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAP16(1);
+	sfi.sfi_direct[0] = SWAP32(block);
+	sfi.sfi_dirbuckets = SWAP32(1);
 
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
@@ -231,8 +248,8 @@ main(int argc, char **argv)
 	/* Write out the on-disk structures */
 	initfreemap(size);
 	writesuper(volname, size);
+	writerootdir(size);
 	writefreemap(size);
-	writerootdir();
 
 	closedisk();
 
@@ -47,6 +47,66 @@
 #include "passes.h"
 #include "main.h"
 
+/*
+ * Check the hash index of an indexed directory, after all the other
+ * fixes have been made to its entries. An entry in neither its home
+ * bucket nor the buddy (including ones we just added or renamed) is
+ * moved to a free slot in one of them. If both are full, or the
+ * index doesn't match the directory size, the index is removed and
+ * the directory is left linear, which is always valid.
+ */
+static
+void
+pass2_dirindex(struct sfs_dinode *sfi, struct sfs_direntry *d, uint32_t nd,
+	       const char *pathsofar, int *ichanged, int *dchanged)
+{
+	uint32_t nbuckets = sfi->sfi_dirbuckets;
+	uint32_t i, bucket, home, buddy;
+
+	if ((nbuckets & (nbuckets - 1)) != 0 ||
+	    nbuckets > SFS_DIR_MAXBUCKETS ||
+	    sfi->sfi_size != nbuckets * SFS_BLOCKSIZE) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: Invalid hash index (removed)",
+		      pathsofar);
+		sfi->sfi_dirbuckets = 0;
+		*ichanged = 1;
+		return;
+	}
+	assert(nd == nbuckets * SFS_DIRBUCKET_ENTRIES);
+
+	for (i=0; i<nd; i++) {
+		if (d[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		home = sfsdir_hash(d[i].sfd_name) & (nbuckets - 1);
+		buddy = (home ^ 1) & (nbuckets - 1);
+		bucket = i / SFS_DIRBUCKET_ENTRIES;
+		if (bucket == home || bucket == buddy) {
+			continue;
+		}
+
+		setbadness(EXIT_RECOV);
+		if (sfsdir_tryadd(d + home * SFS_DIRBUCKET_ENTRIES,
+				  SFS_DIRBUCKET_ENTRIES,
+				  d[i].sfd_name, d[i].sfd_ino) &&
+		    sfsdir_tryadd(d + buddy * SFS_DIRBUCKET_ENTRIES,
+				  SFS_DIRBUCKET_ENTRIES,
+				  d[i].sfd_name, d[i].sfd_ino)) {
+			warnx("Directory %s: No room in hash bucket for %s "
+			      "(index removed)", pathsofar, d[i].sfd_name);
+			sfi->sfi_dirbuckets = 0;
+			*ichanged = 1;
+			return;
+		}
+		warnx("Directory %s: %s in wrong hash bucket (moved)",
+		      pathsofar, d[i].sfd_name);
+		d[i].sfd_ino = SFS_NOINO;
+		bzero(d[i].sfd_name, sizeof(d[i].sfd_name));
+		*dchanged = 1;
+	}
+}
+
 /*
  * Process a directory. INO is the inode number; PARENTINO is the
  * parent's inode number; PATHSOFAR is the path to this directory.
@@ -297,6 +357,15 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		ichanged = 1;
 	}
 
+	/*
+	 * Check the hash index, if any.
+	 */
+
+	if (sfi.sfi_dirbuckets != 0) {
+		pass2_dirindex(&sfi, direntries, ndirentries, pathsofar,
+			       &ichanged, &dchanged);
+	}
+
 	/*
 	 * Write back anything that changed, clean up, and return.
 	 */
@@ -97,6 +97,8 @@ swapinode(struct sfs_dinode *sfi)
 	for (i=0; i<NUM_III; i++) {
 		SET_III(sfi, i) = SWAP32(GET_III(sfi, i));
 	}
+
+	sfi->sfi_dirbuckets = SWAP32(sfi->sfi_dirbuckets);
 }
 
 static
@@ -462,3 +464,18 @@ sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
 	}
 	return -1;
 }
+
+/*
+ * Hash a name for the directory index (32-bit FNV-1a; see kern/sfs.h).
+ */
+uint32_t
+sfsdir_hash(const char *name)
+{
+	uint32_t hash = SFS_DIRHASH_BASIS;
+
+	for (; *name != 0; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= SFS_DIRHASH_PRIME;
+	}
+	return hash;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * oversleep - measure how long nanosleep really sleeps.
+ * Usage: oversleep [-n count] [usecs...]
+ *
+ * Sleeps COUNT times (default 20) for each of the given lengths (in
+ * microseconds; default a spread from 1 ms to 100 ms) and prints, for
+ * each length, the least, average, and most it overslept by and a
+ * histogram of the oversleeps. Waking early is an error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define DEFAULT_COUNT 20
+
+static const unsigned long default_usecs[] = {
+	1000, 2000, 5000, 10000, 20000, 50000, 100000,
+};
+#define NDEFAULT (sizeof(default_usecs) / sizeof(default_usecs[0]))
+
+/* Upper bounds of the histogram buckets, in microseconds. */
+static const long bucket_usecs[] = {
+	50, 100, 200, 500, 1000, 2000, 5000, 10000,
+};
+#define NBUCKETS (sizeof(bucket_usecs) / sizeof(bucket_usecs[0]))
+
+static
+long long
+now_nsecs(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs) < 0) {
+		err(1, "__time");
+	}
+	return (long long)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Sleep COUNT times for USECS and report. Returns the number of
+ * early wakeups.
+ */
+static
+unsigned
+measure(unsigned long usecs, unsigned count)
+{
+	unsigned hist[NBUCKETS + 1];
+	long long start, sum;
+	long over, min, max;
+	unsigned i, j, early;
+
+	memset(hist, 0, sizeof(hist));
+	sum = 0;
+	min = max = 0;
+	early = 0;
+
+	for (i=0; i<count; i++) {
+		start = now_nsecs();
+		if (usleep(usecs) < 0) {
+			err(1, "usleep %lu", usecs);
+		}
+		over = (long)((now_nsecs() - start) / 1000) - (long)usecs;
+
+		if (over < 0) {
+			early++;
+		}
+		if (i == 0 || over < min) {
+			min = over;
+		}
+		if (i == 0 || over > max) {
+			max = over;
+		}
+		sum += over;
+
+		for (j=0; j<NBUCKETS; j++) {
+			if (over < bucket_usecs[j]) {
+				break;
+			}
+		}
+		hist[j]++;
+	}
+
+	printf("%8lu us: over min %ld avg %ld max %ld us",
+	       usecs, min, (long)(sum / count), max);
+	if (early > 0) {
+		printf(" (%u early)", early);
+	}
+	printf("\n");
+
+	for (j=0; j<=NBUCKETS; j++) {
+		if (hist[j] == 0) {
+			continue;
+		}
+		if (j == NBUCKETS) {
+			printf("    >= %6ld us: %u\n", bucket_usecs[j-1],
+			       hist[j]);
+		}
+		else {
+			printf("    <  %6ld us: %u\n", bucket_usecs[j],
+			       hist[j]);
+		}
+	}
+	return early;
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: oversleep [-n count] [usecs...]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned count = DEFAULT_COUNT;
+	unsigned early = 0;
+	unsigned i;
+	int argn = 1;
+
+	if (argn < argc && !strcmp(argv[argn], "-n")) {
+		if (argn + 1 >= argc) {
+			usage();
+		}
+		count = atoi(argv[argn + 1]);
+		if (count == 0) {
+			usage();
+		}
+		argn += 2;
+	}
+
+	if (argn < argc) {
+		for (; argn < argc; argn++) {
+			early += measure(atoi(argv[argn]), count);
+		}
+	}
+	else {
+		for (i=0; i<NDEFAULT; i++) {
+			early += measure(default_usecs[i], count);
+		}
+	}
+
+	if (early > 0) {
+		errx(1, "FAILED: woke up early %u times", early);
+	}
+	printf("oversleep: done\n");
+	return 0;
+}